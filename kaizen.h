@@ -42,6 +42,7 @@
 #include <sstream>
 #include <ostream>
 #include <utility>
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <random>
@@ -51,12 +52,23 @@
 #include <array>
 #include <deque>
 #include <ctime>
+#include <cmath>
 #include <queue>
 #include <stack>
 #include <list>
 #include <set>
 #include <map>
 
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#define ZEN_HAS_TSC 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#include <cpuid.h>
+#endif
+#endif
+
 namespace zen {
 
 ///////////////////////////////////////////////////////////////////////////////////////////// MISC
@@ -1646,23 +1658,111 @@ std::string adaptive_duration(const std::chrono::duration<Rep, Period>& d)
 
 ///////////////////////////////////////////////////////////////////////////////////////////// zen::timer
 
+// Invariant time-stamp counter: ticks at a constant rate regardless of P-states and C-states.
+// The rate is calibrated once against std::chrono::steady_clock on first use.
+class tsc {
+public:
+    static bool invariant()
+    {
+        static const bool available = ((extended_edx(0x80000007) >> 8) & 1) != 0; // EDX bit 8: invariant TSC
+        return available;
+    }
+
+    // Hypervisors may mask RDTSCP even when the TSC itself is invariant; executing it anyway
+    // raises #UD, so now() checks for it and otherwise fences a plain rdtsc.
+    static bool has_rdtscp()
+    {
+        static const bool available = ((extended_edx(0x80000001) >> 27) & 1) != 0; // EDX bit 27: RDTSCP
+        return available;
+    }
+
+    // rdtscp waits for earlier instructions to retire (lfence does the same for rdtsc);
+    // the trailing lfence keeps later instructions from starting before the counter is read.
+    static std::uint64_t now()
+    {
+#ifdef ZEN_HAS_TSC
+        std::uint64_t cycles;
+        _mm_lfence();
+        if (has_rdtscp()) {
+            unsigned int aux;
+            cycles = __rdtscp(&aux);
+        } else {
+            cycles = __rdtsc();
+        }
+        _mm_lfence();
+        return cycles;
+#else
+        return 0;
+#endif
+    }
+
+    static double ghz()
+    {
+        static const double rate = calibrate();
+        return rate;
+    }
+
+private:
+    // EDX of an extended CPUID leaf, or 0 when the leaf is not implemented.
+    static unsigned int extended_edx(unsigned int leaf)
+    {
+#ifdef ZEN_HAS_TSC
+        unsigned int regs[4] = {};
+#if defined(_MSC_VER)
+        int r[4];
+        __cpuid(r, 0x80000000);
+        if (static_cast<unsigned int>(r[0]) < leaf) return 0;
+        __cpuid(r, static_cast<int>(leaf));
+        regs[3] = static_cast<unsigned int>(r[3]);
+#else
+        if (__get_cpuid_max(0x80000000, nullptr) < leaf) return 0;
+        __cpuid(leaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+        return regs[3];
+#else
+        (void)leaf;
+        return 0;
+#endif
+    }
+
+    static double calibrate()
+    {
+        if (!invariant()) return 0.0;
+        const auto wall_start = std::chrono::steady_clock::now();
+        const std::uint64_t tsc_start = now();
+        while (std::chrono::steady_clock::now() - wall_start < std::chrono::milliseconds(20)) {}
+        const std::uint64_t tsc_stop = now();
+        const auto wall_stop = std::chrono::steady_clock::now();
+        const double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(wall_stop - wall_start).count());
+        return static_cast<double>(tsc_stop - tsc_start) / ns;
+    }
+};
+
+// Uses the invariant TSC when CPUID reports one and std::chrono::high_resolution_clock otherwise.
 class timer {
 public:
-    timer() : start_(std::chrono::high_resolution_clock::now()), 
+    timer() : use_tsc_(tsc::invariant() && tsc::ghz() > 0.0),
+              start_(std::chrono::high_resolution_clock::now()),
                stop_(std::chrono::high_resolution_clock::now())
-    {}
+    {
+        if (use_tsc_) start_cycles_ = stop_cycles_ = tsc::now();
+    }
 
-    auto start() { start_ = std::chrono::high_resolution_clock::now(); return *this; }
-    auto stop()  {  stop_ = std::chrono::high_resolution_clock::now(); return *this; }
+    auto start() { if (use_tsc_) start_cycles_ = tsc::now(); else start_ = std::chrono::high_resolution_clock::now(); return *this; }
+    auto stop()  { if (use_tsc_)  stop_cycles_ = tsc::now(); else  stop_ = std::chrono::high_resolution_clock::now(); return *this; }
 
     template<class Duration>
     auto elapsed() const {
+        if (use_tsc_)
+            return std::chrono::duration_cast<Duration>(cycles_to_ns(tsc::now() - start_cycles_));
         const auto now = std::chrono::high_resolution_clock::now();
         return std::chrono::duration_cast<Duration>(now - start_);
     }
 
     template<class Duration>
     auto duration() const {
+        if (use_tsc_)
+            return std::chrono::duration_cast<Duration>(cycles_to_ns(stop_cycles_ - start_cycles_));
         return std::chrono::duration_cast<Duration>(stop_ - start_);
     }
 
@@ -1670,6 +1770,15 @@ public:
         return adaptive_duration(duration<nsec>());
     }
 
+    // TSC cycles between start() and stop(); 0 when the chrono backend is in use
+    std::uint64_t cycles() const { return use_tsc_ ? stop_cycles_ - start_cycles_ : 0; }
+
+    double cycles_per(std::uint64_t elements) const {
+        return elements ? static_cast<double>(cycles()) / static_cast<double>(elements) : 0.0;
+    }
+
+    bool uses_tsc() const { return use_tsc_; }
+
     using nsec = std::chrono::nanoseconds;
     using usec = std::chrono::microseconds;
     using msec = std::chrono::milliseconds;
@@ -1682,12 +1791,19 @@ public:
   //using y    = std::chrono::years;  // since C++20
 
 private:
+    static std::chrono::nanoseconds cycles_to_ns(std::uint64_t cycles) {
+        return std::chrono::nanoseconds(static_cast<std::int64_t>(static_cast<double>(cycles) / tsc::ghz() + 0.5));
+    }
+
+    bool use_tsc_;
+    std::uint64_t start_cycles_ = 0;
+    std::uint64_t  stop_cycles_ = 0;
     std::chrono::time_point<std::chrono::high_resolution_clock> start_;
     std::chrono::time_point<std::chrono::high_resolution_clock>  stop_;
 };
 
-template<typename Duration = timer::nsec>
-auto measure_execution(std::function<void()> operation)
+template<typename Duration = timer::nsec, class Operation>
+auto measure_execution(Operation&& operation)
 {
     timer t;
     operation();
@@ -1695,6 +1811,75 @@ auto measure_execution(std::function<void()> operation)
     return t.duration<Duration>();
 }
 
+// Summary of repeated timings, kept in nanoseconds
+class execution_stats {
+public:
+    explicit execution_stats(std::vector<double> samples_ns) : samples_(std::move(samples_ns))
+    {
+        std::sort(samples_.begin(), samples_.end());
+    }
+
+    double min()    const { return samples_.empty() ? 0.0 : samples_.front(); }
+    double max()    const { return samples_.empty() ? 0.0 : samples_.back(); }
+    double median() const { return percentile(50.0); }
+
+    double mean() const
+    {
+        if (samples_.empty()) return 0.0;
+        double sum = 0.0;
+        for (double s : samples_) sum += s;
+        return sum / static_cast<double>(samples_.size());
+    }
+
+    double stddev() const
+    {
+        if (samples_.size() < 2) return 0.0;
+        const double m = mean();
+        double sum = 0.0;
+        for (double s : samples_) sum += (s - m) * (s - m);
+        return std::sqrt(sum / static_cast<double>(samples_.size() - 1));
+    }
+
+    // Linear interpolation between the closest ranks, p in [0, 100]
+    double percentile(double p) const
+    {
+        if (samples_.empty()) return 0.0;
+        const double rank = std::clamp(p, 0.0, 100.0) / 100.0 * static_cast<double>(samples_.size() - 1);
+        const auto lower = static_cast<std::size_t>(rank);
+        const auto upper = std::min(lower + 1, samples_.size() - 1);
+        return samples_[lower] + (samples_[upper] - samples_[lower]) * (rank - static_cast<double>(lower));
+    }
+
+    std::size_t count() const { return samples_.size(); }
+    const std::vector<double>& samples() const { return samples_; }
+
+private:
+    std::vector<double> samples_;
+};
+
+// Times `operation` `repetitions` times; `setup` runs before each repetition, outside the timed region
+template<class Operation, class Setup>
+execution_stats measure_statistics(std::size_t repetitions, Operation&& operation, Setup&& setup)
+{
+    std::vector<double> samples;
+    samples.reserve(repetitions);
+    for (std::size_t i = 0; i < repetitions; ++i) {
+        setup();
+        timer t;
+        t.start();
+        operation();
+        t.stop();
+        samples.push_back(static_cast<double>(t.duration<timer::nsec>().count()));
+    }
+    return execution_stats(std::move(samples));
+}
+
+template<class Operation>
+execution_stats measure_statistics(std::size_t repetitions, Operation&& operation)
+{
+    return measure_statistics(repetitions, std::forward<Operation>(operation), [] {});
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////// zen::unordered_map
 
 template<
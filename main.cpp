@@ -4,14 +4,38 @@
 #include <cmath>
 #include <limits>
 #include <iomanip>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <thread>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <set>
+#include <atomic>
+#include <array>
+#include <utility>
+#include <map>
+#include <tuple>
+#include <stdexcept>
+#include <future>
+#include <optional>
 #include "kaizen.h"
 
 #ifdef _WIN32
+#define NOMINMAX  // keep min/max usable as std::min, numeric_limits<T>::max() and stats.max()
 #include <windows.h>
 #else
 #define _GNU_SOURCE
 #include <sched.h>
+#include <pthread.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #endif
 
 #if defined(_MSC_VER)
@@ -20,6 +44,17 @@
 #include <cpuid.h>
 #endif
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define HAS_SSE2 1
+#endif
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
 #ifdef __APPLE__
 #include <mach/thread_act.h>
 #include <mach/thread_policy.h>
@@ -27,10 +62,10 @@
 
 using namespace std;
 
-void getCpuid(int leaf, int subleaf, unsigned int& eax, unsigned int& ebx, unsigned int& ecx, unsigned int& edx) {
+void getCpuid(unsigned int leaf, unsigned int subleaf, unsigned int& eax, unsigned int& ebx, unsigned int& ecx, unsigned int& edx) {
 #if defined(_MSC_VER)
     int regs[4];
-    __cpuidex(regs, leaf, subleaf);
+    __cpuidex(regs, static_cast<int>(leaf), static_cast<int>(subleaf));
     eax = regs[0];
     ebx = regs[1];
     ecx = regs[2];
@@ -40,38 +75,97 @@ void getCpuid(int leaf, int subleaf, unsigned int& eax, unsigned int& ebx, unsig
 #endif
 }
 
-bool getCacheParameters(int& l1CacheSizeKB, int& associativity, int& cacheLineSize) {
+bool isAmdCpu() {
     unsigned int eax, ebx, ecx, edx;
+    getCpuid(0, 0, eax, ebx, ecx, edx);
+    return ebx == 0x68747541 && edx == 0x69746E65 && ecx == 0x444D4163; // "AuthenticAMD"
+}
 
-    for (int i = 0; i < 10; i++) {
-        getCpuid(4, i, eax, ebx, ecx, edx);
+// Decodes the common 4K-page data TLB descriptors of CPUID leaf 2.
+void decodeTlbDescriptor(unsigned int descriptor, int& dtlbEntries, int& stlbEntries) {
+    switch (descriptor) {
+    case 0x03: dtlbEntries = 64; break;
+    case 0x5B: dtlbEntries = 64; break;
+    case 0x5C: dtlbEntries = 128; break;
+    case 0x5D: dtlbEntries = 256; break;
+    case 0xB3: dtlbEntries = 128; break;
+    case 0xB4: dtlbEntries = 256; break;
+    case 0xBA: dtlbEntries = 64; break;
+    case 0xC1: stlbEntries = 1024; break;
+    case 0xC3: stlbEntries = 1536; break;
+    case 0xCA: stlbEntries = 512; break;
+    }
+}
 
-        if ((eax & 0x1F) == 0) break;
+// Detects the number of 4K-page entries in the first-level data TLB and the second-level (shared) TLB.
+// Intel: CPUID leaf 0x18, then leaf 2 descriptors. AMD: leaves 0x80000005/0x80000006.
+// Otherwise "TLB size" from /proc/cpuinfo, and finally 64/1536 entries (with a warning unless quiet).
+bool getTlbParameters(int& dtlbEntries, int& stlbEntries, bool quiet = false) {
+    unsigned int eax, ebx, ecx, edx;
+    dtlbEntries = 0;
+    stlbEntries = 0;
+    getCpuid(0, 0, eax, ebx, ecx, edx);
+    unsigned int maxLeaf = eax;
+    getCpuid(0x80000000, 0, eax, ebx, ecx, edx);
+    unsigned int maxExtendedLeaf = eax;
 
-        int cacheType = eax & 0x1F;
-        if (cacheType == 1 || cacheType == 3) {
-            l1CacheSizeKB = ((ebx >> 22) + 1) * (((ebx >> 12) & 0x3FF) + 1) * ((ebx & 0xFFF) + 1) * (ecx + 1) / 1024;
-            associativity = (ebx >> 22) + 1;
-            cacheLineSize = (ebx & 0xFFF) + 1;
-            return true;
+    if (isAmdCpu() && maxExtendedLeaf >= 0x80000006) {
+        getCpuid(0x80000005, 0, eax, ebx, ecx, edx);
+        dtlbEntries = (ebx >> 16) & 0xFF;
+        getCpuid(0x80000006, 0, eax, ebx, ecx, edx);
+        stlbEntries = (ebx >> 16) & 0xFFF;
+    } else if (maxLeaf >= 0x18) {
+        getCpuid(0x18, 0, eax, ebx, ecx, edx);
+        unsigned int maxSubleaf = eax;
+        for (unsigned int sub = 0; sub <= maxSubleaf; sub++) {
+            getCpuid(0x18, sub, eax, ebx, ecx, edx);
+            int type = edx & 0x1F;
+            int level = (edx >> 5) & 0x7;
+            bool has4K = ebx & 1;
+            int entries = static_cast<int>((ebx >> 16) & 0xFFFF) * static_cast<int>(ecx);
+            if (type == 0 || !has4K) continue;
+            if (level == 1 && (type == 1 || type == 4))
+                dtlbEntries = max(dtlbEntries, entries);
+            else if (level == 2 && (type == 1 || type == 3))
+                stlbEntries = max(stlbEntries, entries);
         }
     }
-
-    l1CacheSizeKB = 32;
-    associativity = 8;
-    cacheLineSize = 64;
-    cerr << "Warning: Could not detect cache parameters via CPUID. Using fallback values." << endl;
-    return false;
+    if ((dtlbEntries == 0 || stlbEntries == 0) && maxLeaf >= 2) {
+        getCpuid(2, 0, eax, ebx, ecx, edx);
+        for (unsigned int reg : { eax & 0xFFFFFF00, ebx, ecx, edx }) {
+            if (reg & 0x80000000) continue;
+            for (int byte = 0; byte < 4; byte++) {
+                int dtlb = 0, stlb = 0;
+                decodeTlbDescriptor((reg >> (8 * byte)) & 0xFF, dtlb, stlb);
+                if (dtlbEntries == 0) dtlbEntries = dtlb;
+                if (stlbEntries == 0) stlbEntries = stlb;
+            }
+        }
+    }
+#ifdef __linux__
+    if (stlbEntries == 0) {
+        ifstream cpuinfo("/proc/cpuinfo");
+        string line;
+        while (getline(cpuinfo, line)) {
+            if (line.rfind("TLB size", 0) == 0) {
+                stlbEntries = atoi(line.substr(line.find(':') + 1).c_str());
+                break;
+            }
+        }
+    }
+#endif
+    bool detected = dtlbEntries > 0 && stlbEntries > 0;
+    if (dtlbEntries == 0) dtlbEntries = 64;
+    if (stlbEntries == 0) stlbEntries = 1536;
+    if (!detected && !quiet)
+        cerr << "Warning: Could not fully detect TLB parameters. Using fallback values." << endl;
+    return detected;
 }
 
+// Pins the calling thread only; other threads keep their own affinity.
 bool pinToCore(int coreId) {
 #ifdef _WIN32
     DWORD_PTR affinityMask = 1ULL << coreId;
-    HANDLE process = GetCurrentProcess();
-    if (SetProcessAffinityMask(process, affinityMask) == 0) {
-        cerr << "Failed to set process affinity on Windows: " << GetLastError() << endl;
-        return false;
-    }
     HANDLE thread = GetCurrentThread();
     if (SetThreadAffinityMask(thread, affinityMask) == 0) {
         cerr << "Failed to set thread affinity on Windows: " << GetLastError() << endl;
@@ -82,9 +176,9 @@ bool pinToCore(int coreId) {
     cpu_set_t mask;
     CPU_ZERO(&mask);
     CPU_SET(coreId, &mask);
-    pid_t pid = getpid();
-    if (sched_setaffinity(pid, sizeof(cpu_set_t), &mask) == -1) {
-        perror("Failed to set affinity on Linux");
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &mask);
+    if (error != 0) {
+        cerr << "Failed to set thread affinity on Linux: " << strerror(error) << endl;
         return false;
     }
     return true;
@@ -103,43 +197,754 @@ bool pinToCore(int coreId) {
 #endif
 }
 
-int selectPerformanceCore() {
-#ifdef _WIN32
-    SYSTEM_INFO sysInfo;
-    GetSystemInfo(&sysInfo);
-    int numCores = sysInfo.dwNumberOfProcessors;
-    return (numCores > 0) ? 0 : 0;
+vector<int> parseCpuList(const string& text) {
+    vector<int> cpus;
+    stringstream ranges(text);
+    string range;
+    while (getline(ranges, range, ',')) {
+        if (range.empty() || !isdigit(static_cast<unsigned char>(range[0]))) continue;
+        size_t dash = range.find('-');
+        int first = stoi(range.substr(0, dash));
+        int last = dash == string::npos ? first : stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; cpu++)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+string readFirstLine(const string& path) {
+    ifstream file(path);
+    string line;
+    getline(file, line);
+    return line;
+}
+
+long readSysfsNumber(const string& path, long fallback = -1) {
+    string line = readFirstLine(path);
+    return line.empty() ? fallback : atol(line.c_str());
+}
+
+enum class CoreType { Unknown, Performance, Efficiency };
+
+struct CpuDescription {
+    int id = 0;
+    CoreType type = CoreType::Unknown;
+    long capacity = -1;
+    long maxFrequencyKHz = -1;
+    double busy = 0.0;
+    vector<int> siblings;
+};
+
+#ifdef __linux__
+// CPUID leaf 0x1A describes the core the instruction runs on, so the calling thread is moved onto
+// each CPU in turn and then restored. Only meaningful when leaf 7 reports a hybrid part.
+CoreType detectCoreType(int cpu) {
+    unsigned int eax, ebx, ecx, edx;
+    getCpuid(0, 0, eax, ebx, ecx, edx);
+    if (eax < 0x1A) return CoreType::Unknown;
+    getCpuid(7, 0, eax, ebx, ecx, edx);
+    if (!((edx >> 15) & 1)) return CoreType::Unknown;
+
+    cpu_set_t previous, target;
+    if (pthread_getaffinity_np(pthread_self(), sizeof(previous), &previous) != 0) return CoreType::Unknown;
+    CPU_ZERO(&target);
+    CPU_SET(cpu, &target);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(target), &target) != 0) return CoreType::Unknown;
+    getCpuid(0x1A, 0, eax, ebx, ecx, edx);
+    pthread_setaffinity_np(pthread_self(), sizeof(previous), &previous);
+
+    switch (eax >> 24) {
+    case 0x40: return CoreType::Performance;
+    case 0x20: return CoreType::Efficiency;
+    default:   return CoreType::Unknown;
+    }
+}
+
+// Busy fraction of every CPU over a short window, from /proc/stat.
+map<int, double> sampleCpuBusy(chrono::milliseconds window) {
+    auto snapshot = []() {
+        map<int, pair<unsigned long long, unsigned long long>> ticks;
+        ifstream stat("/proc/stat");
+        string line;
+        while (getline(stat, line)) {
+            if (line.rfind("cpu", 0) != 0 || line.size() < 4 || !isdigit(static_cast<unsigned char>(line[3]))) continue;
+            istringstream fields(line.substr(3));
+            int cpu;
+            unsigned long long value, total = 0, idle = 0;
+            fields >> cpu;
+            for (int k = 0; fields >> value; k++) {
+                total += value;
+                if (k == 3 || k == 4) idle += value;
+            }
+            ticks[cpu] = { total, idle };
+        }
+        return ticks;
+    };
+    auto before = snapshot();
+    this_thread::sleep_for(window);
+    auto after = snapshot();
+    map<int, double> busy;
+    for (const auto& [cpu, now] : after) {
+        auto it = before.find(cpu);
+        if (it == before.end()) continue;
+        double total = static_cast<double>(now.first - it->second.first);
+        double idle = static_cast<double>(now.second - it->second.second);
+        busy[cpu] = total > 0 ? 1.0 - idle / total : 0.0;
+    }
+    return busy;
+}
+#endif
+
+// CPUs the process may run on, captured on first use so that later per-thread pinning does not
+// shrink the set the worker placement chooses from. main() calls it before it pins anything.
+const vector<int>& allowedCpus() {
+    static const vector<int> cpus = [] {
+        vector<int> ids;
+#ifdef __linux__
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        if (sched_getaffinity(0, sizeof(cpu_set_t), &mask) == -1) {
+            perror("Failed to get affinity");
+            return ids;
+        }
+        for (int i = 0; i < CPU_SETSIZE; i++)
+            if (CPU_ISSET(i, &mask))
+                ids.push_back(i);
 #else
+        for (unsigned i = 0; i < max(thread::hardware_concurrency(), 1u); i++)
+            ids.push_back(static_cast<int>(i));
+#endif
+        return ids;
+    }();
+    return cpus;
+}
+
+// CPU the calling thread is running on, or -1 where the platform cannot tell.
+int currentCpu() {
 #ifdef __linux__
-    cpu_set_t mask;
-    CPU_ZERO(&mask);
-    if (sched_getaffinity(0, sizeof(cpu_set_t), &mask) == -1) {
-        perror("Failed to get affinity");
-        return 0;
+    return sched_getcpu();
+#elif defined(_WIN32)
+    return static_cast<int>(GetCurrentProcessorNumber());
+#else
+    return -1;
+#endif
+}
+
+// Limits imposed by the enclosing cgroup (e.g. a Kubernetes pod), which sched_getaffinity and
+// hardware_concurrency do not see. cpuQuota is in CPUs (0 = unlimited), memory in bytes (0 = unlimited).
+struct ContainerLimits {
+    double cpuQuota = 0;
+    size_t cpusetCount = 0;
+    size_t memoryLimit = 0;
+    size_t memoryUsage = 0;
+    string version = "none";
+
+    size_t memoryAvailable() const { return memoryLimit > memoryUsage ? memoryLimit - memoryUsage : 0; }
+};
+
+#ifdef __linux__
+// Returns the cgroup directory of this process for one controller ("" selects the v2 unified
+// hierarchy), or the mount root when the path is hidden by a cgroup namespace.
+string cgroupDirectory(const string& controller) {
+    ifstream file("/proc/self/cgroup");
+    string line;
+    while (getline(file, line)) {
+        size_t first = line.find(':');
+        size_t second = line.find(':', first + 1);
+        if (first == string::npos || second == string::npos) continue;
+        string controllers = line.substr(first + 1, second - first - 1);
+        string path = line.substr(second + 1);
+        string mount;
+        if (controller.empty()) {
+            if (line.compare(0, first, "0") != 0 || !controllers.empty()) continue;
+            mount = "/sys/fs/cgroup";
+        } else {
+            stringstream list(controllers);
+            string name;
+            bool matches = false;
+            while (getline(list, name, ','))
+                matches = matches || name == controller;
+            if (!matches) continue;
+            mount = "/sys/fs/cgroup/" + controllers;
+            if (!ifstream(mount + "/cgroup.procs"))
+                mount = "/sys/fs/cgroup/" + controller;
+        }
+        if (ifstream(mount + path + "/cgroup.procs"))
+            return mount + path;
+        return mount;
     }
-    for (int i = 0; i < CPU_SETSIZE; i++) {
-        if (CPU_ISSET(i, &mask)) return i;
+    return "";
+}
+
+// Visits dir and each ancestor up to the hierarchy root, since a parent's limit also applies.
+template<class Visit>
+void forEachCgroupAncestor(string dir, Visit visit) {
+    while (!dir.empty()) {
+        visit(dir);
+        if (dir == "/sys/fs/cgroup" || ifstream(dir + "/../cgroup.procs").fail()) break;
+        dir = dir.substr(0, dir.find_last_of('/'));
+    }
+}
+#endif
+
+const ContainerLimits& containerLimits() {
+    static const ContainerLimits limits = [] {
+        ContainerLimits found;
+#ifdef __linux__
+        string unified = cgroupDirectory("");
+        if (!unified.empty() && ifstream("/sys/fs/cgroup/cgroup.controllers")) {
+            found.version = "v2";
+            forEachCgroupAncestor(unified, [&](const string& dir) {
+                string quota;
+                long period = 0;
+                ifstream cpuMax(dir + "/cpu.max");
+                if (cpuMax >> quota >> period && quota != "max" && period > 0) {
+                    double cpus = stod(quota) / period;
+                    if (found.cpuQuota == 0 || cpus < found.cpuQuota)
+                        found.cpuQuota = cpus;
+                }
+                string memoryMax = readFirstLine(dir + "/memory.max");
+                if (!memoryMax.empty() && memoryMax != "max") {
+                    size_t bytes = stoull(memoryMax);
+                    if (found.memoryLimit == 0 || bytes < found.memoryLimit) {
+                        found.memoryLimit = bytes;
+                        found.memoryUsage = static_cast<size_t>(max(readSysfsNumber(dir + "/memory.current", 0), 0L));
+                    }
+                }
+            });
+            found.cpusetCount = parseCpuList(readFirstLine(unified + "/cpuset.cpus.effective")).size();
+            if (found.memoryLimit == 0)
+                found.memoryUsage = static_cast<size_t>(max(readSysfsNumber(unified + "/memory.current", 0), 0L));
+            return found;
+        }
+
+        string cpuDir = cgroupDirectory("cpu");
+        if (!cpuDir.empty()) {
+            found.version = "v1";
+            forEachCgroupAncestor(cpuDir, [&](const string& dir) {
+                long quota = readSysfsNumber(dir + "/cpu.cfs_quota_us");
+                long period = readSysfsNumber(dir + "/cpu.cfs_period_us");
+                if (quota > 0 && period > 0) {
+                    double cpus = static_cast<double>(quota) / period;
+                    if (found.cpuQuota == 0 || cpus < found.cpuQuota)
+                        found.cpuQuota = cpus;
+                }
+            });
+        }
+        string cpusetDir = cgroupDirectory("cpuset");
+        if (!cpusetDir.empty())
+            found.cpusetCount = parseCpuList(readFirstLine(cpusetDir + "/cpuset.effective_cpus")).size();
+        string memoryDir = cgroupDirectory("memory");
+        if (!memoryDir.empty()) {
+            found.version = "v1";
+            forEachCgroupAncestor(memoryDir, [&](const string& dir) {
+                long limit = readSysfsNumber(dir + "/memory.limit_in_bytes", 0);
+                // v1 reports "unlimited" as a page-rounded LONG_MAX.
+                if (limit > 0 && limit < (1L << 62) && (found.memoryLimit == 0 || static_cast<size_t>(limit) < found.memoryLimit)) {
+                    found.memoryLimit = static_cast<size_t>(limit);
+                    found.memoryUsage = static_cast<size_t>(max(readSysfsNumber(dir + "/memory.usage_in_bytes", 0), 0L));
+                }
+            });
+            if (found.memoryLimit == 0)
+                found.memoryUsage = static_cast<size_t>(max(readSysfsNumber(memoryDir + "/memory.usage_in_bytes", 0), 0L));
+        }
+#endif
+        return found;
+    }();
+    return limits;
+}
+
+// Storage of an n x n vector<vector<int>>, row headers included.
+size_t squareMatrixBytes(size_t n) {
+    return n * (n * sizeof(int) + sizeof(vector<int>));
+}
+
+// Keeps 10% of the cgroup's headroom back for the allocator and everything else in the process.
+bool exceedsMemoryLimit(size_t requiredBytes) {
+    const ContainerLimits& limits = containerLimits();
+    return limits.memoryLimit > 0 && requiredBytes > limits.memoryAvailable() * 9 / 10;
+}
+
+// For modes without an in-place fallback: reports and refuses a run that would not fit the cgroup.
+bool fitsMemoryLimit(size_t requiredBytes, const char* mode) {
+    if (!exceedsMemoryLimit(requiredBytes))
+        return true;
+    const ContainerLimits& limits = containerLimits();
+    cerr << "Error: " << mode << " needs " << (requiredBytes >> 20) << " MB but the " << limits.version
+         << " cgroup leaves " << (limits.memoryAvailable() >> 20) << " MB" << endl;
+    return false;
+}
+
+struct CacheLevel {
+    int level;
+    string type;       // "Data", "Instruction" or "Unified"
+    size_t sizeBytes;
+    int ways;
+    int lineSize;
+    int sharedBy;      // logical CPUs sharing this cache
+};
+
+// Leaf 4 (Intel) and leaf 0x8000001D (AMD) share one register layout.
+vector<CacheLevel> readDeterministicCacheLeaf(unsigned int leaf) {
+    static const char* typeNames[] = { "", "Data", "Instruction", "Unified" };
+    vector<CacheLevel> caches;
+    unsigned int eax, ebx, ecx, edx;
+    for (unsigned int i = 0; i < 16; i++) {
+        getCpuid(leaf, i, eax, ebx, ecx, edx);
+        unsigned int type = eax & 0x1F;
+        if (type == 0 || type > 3) break;
+        int ways = static_cast<int>((ebx >> 22) + 1);
+        int partitions = static_cast<int>(((ebx >> 12) & 0x3FF) + 1);
+        int line = static_cast<int>((ebx & 0xFFF) + 1);
+        size_t sets = static_cast<size_t>(ecx) + 1;
+        caches.push_back({ static_cast<int>((eax >> 5) & 0x7), typeNames[type],
+                           static_cast<size_t>(ways) * partitions * line * sets, ways, line,
+                           static_cast<int>(((eax >> 14) & 0xFFF) + 1) });
+    }
+    return caches;
+}
+
+// Associativity field of AMD leaf 0x80000006.
+int decodeAmdAssociativity(unsigned int code, size_t sizeBytes, int lineSize) {
+    switch (code) {
+    case 0x1: return 1;
+    case 0x2: return 2;
+    case 0x3: return 3;
+    case 0x4: return 4;
+    case 0x5: return 6;
+    case 0x6: return 8;
+    case 0x8: return 16;
+    case 0x9: return 16; // deferred to leaf 0x8000001D; 16 is the common value when that leaf is missing
+    case 0xA: return 32;
+    case 0xB: return 48;
+    case 0xC: return 64;
+    case 0xD: return 96;
+    case 0xE: return 128;
+    case 0xF: return lineSize > 0 ? static_cast<int>(sizeBytes / lineSize) : 0; // fully associative
     }
     return 0;
+}
+
+size_t parseCacheSize(const string& text) {
+    if (text.empty()) return 0;
+    size_t value = strtoull(text.c_str(), nullptr, 10);
+    switch (text.back()) {
+    case 'K': return value << 10;
+    case 'M': return value << 20;
+    case 'G': return value << 30;
+    }
+    return value;
+}
+
+// Reads the cache hierarchy of one CPU: /sys/devices/system/cpu/cpuN/cache/index*, then AMD
+// leaf 0x8000001D, then AMD leaves 0x80000005/6, then Intel leaf 4. The CPUID paths describe the
+// CPU the caller runs on, so callers pin to cpu first. Empty if all of them fail.
+vector<CacheLevel> detectCacheHierarchy(int cpu, string& detectedBy) {
+    vector<CacheLevel> found;
+    detectedBy = "none";
+#ifdef __linux__
+    string base = "/sys/devices/system/cpu/cpu" + to_string(cpu) + "/cache/index";
+    for (int index = 0; index < 16; index++) {
+        string dir = base + to_string(index);
+        long level = readSysfsNumber(dir + "/level");
+        if (level < 0) break;
+        CacheLevel cache = { static_cast<int>(level), readFirstLine(dir + "/type"),
+                             parseCacheSize(readFirstLine(dir + "/size")),
+                             static_cast<int>(readSysfsNumber(dir + "/ways_of_associativity", 0)),
+                             static_cast<int>(readSysfsNumber(dir + "/coherency_line_size", 64)),
+                             max(static_cast<int>(parseCpuList(readFirstLine(dir + "/shared_cpu_list")).size()), 1) };
+        // Some hypervisors omit ways_of_associativity; recover it from the set count.
+        long sets = readSysfsNumber(dir + "/number_of_sets", 0);
+        if (cache.ways <= 0 && sets > 0 && cache.lineSize > 0)
+            cache.ways = static_cast<int>(cache.sizeBytes / (static_cast<size_t>(sets) * cache.lineSize));
+        if (cache.sizeBytes > 0)
+            found.push_back(cache);
+    }
+    if (!found.empty()) {
+        detectedBy = "sysfs";
+        return found;
+    }
+#else
+    (void)cpu;
+#endif
+    unsigned int eax, ebx, ecx, edx;
+    getCpuid(0x80000000, 0, eax, ebx, ecx, edx);
+    unsigned int maxExtended = eax;
+    if (isAmdCpu() && maxExtended >= 0x8000001D) {
+        getCpuid(0x80000001, 0, eax, ebx, ecx, edx);
+        if ((ecx >> 22) & 1) { // TopologyExtensions
+            found = readDeterministicCacheLeaf(0x8000001D);
+            if (!found.empty()) {
+                detectedBy = "CPUID 0x8000001D";
+                return found;
+            }
+        }
+    }
+    if (isAmdCpu() && maxExtended >= 0x80000006) {
+        getCpuid(0x80000005, 0, eax, ebx, ecx, edx);
+        if (ecx >> 24)
+            found.push_back({ 1, "Data", static_cast<size_t>(ecx >> 24) << 10,
+                              static_cast<int>((ecx >> 16) & 0xFF), static_cast<int>(ecx & 0xFF), 1 });
+        if (edx >> 24)
+            found.push_back({ 1, "Instruction", static_cast<size_t>(edx >> 24) << 10,
+                              static_cast<int>((edx >> 16) & 0xFF), static_cast<int>(edx & 0xFF), 1 });
+        getCpuid(0x80000006, 0, eax, ebx, ecx, edx);
+        if (ecx >> 16) {
+            size_t size = static_cast<size_t>(ecx >> 16) << 10;
+            int line = static_cast<int>(ecx & 0xFF);
+            found.push_back({ 2, "Unified", size, decodeAmdAssociativity((ecx >> 12) & 0xF, size, line), line, 1 });
+        }
+        if (edx >> 18) {
+            size_t size = static_cast<size_t>(edx >> 18) << 19;
+            int line = static_cast<int>(edx & 0xFF);
+            // The legacy leaf has no sharing field; assume the L3 spans every logical CPU.
+            int sharedBy = max(static_cast<int>(thread::hardware_concurrency()), 1);
+            found.push_back({ 3, "Unified", size, decodeAmdAssociativity((edx >> 12) & 0xF, size, line), line, sharedBy });
+        }
+        if (!found.empty()) {
+            detectedBy = "CPUID 0x80000005/6";
+            return found;
+        }
+    }
+    getCpuid(0, 0, eax, ebx, ecx, edx);
+    if (eax >= 4) {
+        found = readDeterministicCacheLeaf(4);
+        if (!found.empty())
+            detectedBy = "CPUID 4";
+    }
+    return found;
+}
+
+// The hierarchy of the CPU the calling thread runs on, detected once per CPU.
+const vector<CacheLevel>& cacheHierarchy(string* source = nullptr) {
+    struct Detected {
+        vector<CacheLevel> caches;
+        string source;
+    };
+    static mutex cacheMutex;
+    static map<int, Detected> byCpu;
+    int cpu = currentCpu();
+    if (cpu < 0)
+        cpu = allowedCpus().empty() ? 0 : allowedCpus().front();
+    lock_guard<mutex> lock(cacheMutex);
+    auto found = byCpu.find(cpu);
+    if (found == byCpu.end()) {
+        Detected detected;
+        detected.caches = detectCacheHierarchy(cpu, detected.source);
+        found = byCpu.emplace(cpu, move(detected)).first;
+    }
+    if (source) *source = found->second.source;
+    return found->second.caches;
+}
+
+// Smallest data-capable cache at the given level, or nullptr when the level was not detected.
+const CacheLevel* findCacheLevel(int level, const vector<CacheLevel>& caches = cacheHierarchy()) {
+    for (const auto& cache : caches)
+        if (cache.level == level && cache.type != "Instruction")
+            return &cache;
+    return nullptr;
+}
+
+string formatCacheHierarchy() {
+    ostringstream out;
+    for (const auto& cache : cacheHierarchy()) {
+        if (out.tellp() > 0) out << ", ";
+        out << "L" << cache.level << (cache.type == "Data" ? "d" : cache.type == "Instruction" ? "i" : "")
+            << " " << cache.sizeBytes / 1024 << "K " << cache.ways << "-way " << cache.lineSize << "B";
+        if (cache.sharedBy > 1)
+            out << " x" << cache.sharedBy;
+    }
+    return out.str();
+}
+
+bool getCacheParameters(int& l1CacheSizeKB, int& associativity, int& cacheLineSize,
+                        const vector<CacheLevel>& caches = cacheHierarchy(), bool quiet = false) {
+    const CacheLevel* l1 = findCacheLevel(1, caches);
+    if (l1) {
+        l1CacheSizeKB = static_cast<int>(l1->sizeBytes / 1024);
+        associativity = l1->ways > 0 ? l1->ways : 8;
+        cacheLineSize = l1->lineSize > 0 ? l1->lineSize : 64;
+        if ((l1->ways <= 0 || l1->lineSize <= 0) && !quiet)
+            cerr << "Warning: L1 associativity or line size unknown. Using fallback values for those fields." << endl;
+        return true;
+    }
+
+    l1CacheSizeKB = 32;
+    associativity = 8;
+    cacheLineSize = 64;
+    if (!quiet)
+        cerr << "Warning: Could not detect cache parameters via sysfs or CPUID. Using fallback values." << endl;
+    return false;
+}
+
+// With sampleLoad the busy fractions come from a 50 ms /proc/stat window; otherwise they stay 0.
+vector<CpuDescription> describeAllowedCpus(bool sampleLoad = true) {
+    vector<CpuDescription> cpus;
+#ifdef __linux__
+    map<int, double> busy;
+    if (sampleLoad)
+        busy = sampleCpuBusy(chrono::milliseconds(50));
+    for (int i : allowedCpus()) {
+        string base = "/sys/devices/system/cpu/cpu" + to_string(i);
+        CpuDescription cpu;
+        cpu.id = i;
+        cpu.type = detectCoreType(i);
+        cpu.capacity = readSysfsNumber(base + "/cpu_capacity");
+        cpu.maxFrequencyKHz = readSysfsNumber(base + "/cpufreq/cpuinfo_max_freq");
+        cpu.busy = busy.count(i) ? busy[i] : 0.0;
+        cpu.siblings = parseCpuList(readFirstLine(base + "/topology/thread_siblings_list"));
+        if (cpu.siblings.empty())
+            cpu.siblings.push_back(i);
+        cpus.push_back(cpu);
+    }
+#endif
+    return cpus;
+}
+
+const char* coreTypeName(CoreType type) {
+    switch (type) {
+    case CoreType::Performance: return "P-core";
+    case CoreType::Efficiency:  return "E-core";
+    case CoreType::Unknown:     return "core";
+    }
+    return "core";
+}
+
+// Prefers P-cores (CPUID 0x1A); within a core type, an idle CPU (no busy SMT sibling, then the
+// least busy itself) beats a faster busy one, and only then do sysfs cpu_capacity and max
+// frequency decide. The first thread of a physical core wins over its siblings. With a single
+// allowed CPU there is nothing to rank, so no load is sampled and no CPU is probed.
+int selectPerformanceCore(string* reason = nullptr) {
+#ifdef _WIN32
+    DWORD length = 0;
+    GetLogicalProcessorInformationEx(RelationProcessorCore, nullptr, &length);
+    vector<char> buffer(length);
+    auto* info = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data());
+    int best = 0, bestClass = -1;
+    if (length > 0 && GetLogicalProcessorInformationEx(RelationProcessorCore, info, &length)) {
+        for (DWORD offset = 0; offset < length;) {
+            auto* entry = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data() + offset);
+            KAFFINITY coreMask = entry->Processor.GroupMask[0].Mask;
+            if (entry->Processor.GroupMask[0].Group == 0 && coreMask != 0 && entry->Processor.EfficiencyClass > bestClass) {
+                bestClass = entry->Processor.EfficiencyClass;
+                for (int bit = 0; bit < 64; bit++) {
+                    if (coreMask & (KAFFINITY(1) << bit)) { best = bit; break; }
+                }
+            }
+            offset += entry->Size;
+        }
+    }
+    if (reason)
+        *reason = "efficiency class " + to_string(max(bestClass, 0)) + ", first logical processor of the core";
+    return best;
 #else
+#ifdef __linux__
+    if (allowedCpus().size() == 1) {
+        if (reason)
+            *reason = "only CPU in the affinity mask";
+        return allowedCpus().front();
+    }
+    vector<CpuDescription> cpus = describeAllowedCpus();
+    if (cpus.empty()) return 0;
+    map<int, double> busyById;
+    for (const auto& cpu : cpus)
+        busyById[cpu.id] = cpu.busy;
+
+    auto siblingBusy = [&](const CpuDescription& cpu) {
+        double busiest = 0.0;
+        for (int sibling : cpu.siblings)
+            if (sibling != cpu.id && busyById.count(sibling))
+                busiest = max(busiest, busyById[sibling]);
+        return busiest;
+    };
+    auto typeRank = [](CoreType type) { return type == CoreType::Performance ? 2 : type == CoreType::Unknown ? 1 : 0; };
+    auto key = [&](const CpuDescription& cpu) {
+        bool busySibling = siblingBusy(cpu) > 0.25;
+        bool primaryThread = cpu.siblings.front() == cpu.id;
+        return make_tuple(typeRank(cpu.type), !busySibling, -static_cast<int>(cpu.busy * 10),
+                          cpu.capacity, cpu.maxFrequencyKHz, primaryThread, -cpu.id);
+    };
+    const CpuDescription* best = &cpus.front();
+    for (const auto& cpu : cpus)
+        if (key(cpu) > key(*best))
+            best = &cpu;
+
+    if (reason) {
+        ostringstream text;
+        text << coreTypeName(best->type);
+        if (best->maxFrequencyKHz > 0)
+            text << ", " << fixed << setprecision(2) << best->maxFrequencyKHz / 1e6 << " GHz max";
+        if (best->capacity > 0)
+            text << ", capacity " << best->capacity;
+        text << ", " << fixed << setprecision(0) << best->busy * 100 << "% busy";
+        text << ", SMT siblings";
+        for (int sibling : best->siblings)
+            text << " " << sibling;
+        text << ", " << cpus.size() << " CPU(s) considered";
+        *reason = text.str();
+    }
+    return best->id;
+#else
+    if (reason)
+        *reason = "no topology information on this platform";
     return 0;
 #endif
 #endif
 }
 
-int calculateOptimalBlockSize(int l1CacheSizeKB, int associativity, int cacheLineSize, int n) {
-    int l1CacheSizeBytes = l1CacheSizeKB * 1024;
-    int maxBlockSizeBytes = l1CacheSizeBytes / 2;
-    int maxElementsPerBlock = maxBlockSizeBytes / sizeof(int);
-    int maxBlockSide = static_cast<int>(sqrt(maxElementsPerBlock));
-    int elementsPerCacheLine = cacheLineSize / sizeof(int);
-    int alignedBlockSide = maxBlockSide - (maxBlockSide % elementsPerCacheLine);
+// Picks a CPU the kernel keeps quiet: isolated (isolcpus) and nohz_full, then isolated only, then
+// nohz_full only. Only CPUs in the affinity mask count; returns -1 when none of them is isolated.
+int selectIsolatedCore(string* reason = nullptr) {
+#ifdef __linux__
+    auto allowedOnly = [](vector<int> cpus) {
+        const vector<int>& allowed = allowedCpus();
+        cpus.erase(remove_if(cpus.begin(), cpus.end(), [&](int cpu) {
+            return find(allowed.begin(), allowed.end(), cpu) == allowed.end();
+        }), cpus.end());
+        return cpus;
+    };
+    vector<int> isolated = allowedOnly(parseCpuList(readFirstLine("/sys/devices/system/cpu/isolated")));
+    vector<int> tickless = allowedOnly(parseCpuList(readFirstLine("/sys/devices/system/cpu/nohz_full")));
+    for (int cpu : isolated) {
+        if (find(tickless.begin(), tickless.end(), cpu) != tickless.end()) {
+            if (reason) *reason = "isolated, nohz_full";
+            return cpu;
+        }
+    }
+    if (!isolated.empty()) {
+        if (reason) *reason = "isolated";
+        return isolated.front();
+    }
+    if (!tickless.empty()) {
+        if (reason) *reason = "nohz_full";
+        return tickless.front();
+    }
+#else
+    (void)reason;
+#endif
+    return -1;
+}
+
+enum class Placement { Compact, Scatter, Physical, L2Cluster };
+
+const char* placementName(Placement placement) {
+    switch (placement) {
+    case Placement::Compact:   return "compact";
+    case Placement::Scatter:   return "scatter";
+    case Placement::Physical:  return "physical";
+    case Placement::L2Cluster: return "l2";
+    }
+    return "?";
+}
+
+bool parsePlacement(const string& text, Placement& placement) {
+    for (auto candidate : { Placement::Compact, Placement::Scatter, Placement::Physical, Placement::L2Cluster }) {
+        if (text == placementName(candidate)) {
+            placement = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+struct CpuTopology {
+    int id;
+    int package;
+    int core;
+    int l2Cluster;
+    bool primaryThread;
+};
+
+vector<CpuTopology> readCpuTopology() {
+    vector<CpuTopology> topology;
+    for (int id : allowedCpus()) {
+        CpuTopology cpu = { id, 0, id, id, true };
+#ifdef __linux__
+        string base = "/sys/devices/system/cpu/cpu" + to_string(id);
+        cpu.package = static_cast<int>(readSysfsNumber(base + "/topology/physical_package_id", 0));
+        cpu.core = static_cast<int>(readSysfsNumber(base + "/topology/core_id", id));
+        vector<int> siblings = parseCpuList(readFirstLine(base + "/topology/thread_siblings_list"));
+        cpu.primaryThread = siblings.empty() || siblings.front() == id;
+        for (int index = 0; index < 8; index++) {
+            string cache = base + "/cache/index" + to_string(index);
+            if (readSysfsNumber(cache + "/level") != 2) continue;
+            vector<int> sharing = parseCpuList(readFirstLine(cache + "/shared_cpu_list"));
+            if (!sharing.empty())
+                cpu.l2Cluster = sharing.front();
+            break;
+        }
+#endif
+        topology.push_back(cpu);
+    }
+    return topology;
+}
+
+// Orders CPUs for worker k = 0, 1, 2, ...: compact fills SMT siblings and neighbouring cores first,
+// scatter alternates packages, physical uses one thread per core, l2 uses one CPU per L2 cluster.
+// Policies that skip CPUs fall back to the rest once every core or cluster has a worker.
+vector<int> placementOrder(Placement placement) {
+    vector<CpuTopology> cpus = readCpuTopology();
+    sort(cpus.begin(), cpus.end(), [](const CpuTopology& a, const CpuTopology& b) {
+        return make_tuple(a.package, a.core, !a.primaryThread, a.id) < make_tuple(b.package, b.core, !b.primaryThread, b.id);
+    });
 
-    int totalCacheLines = l1CacheSizeBytes / cacheLineSize;
-    int numSets = totalCacheLines / associativity;
-    int linesPerBlock = (alignedBlockSide * alignedBlockSide * sizeof(int)) / cacheLineSize;
+    vector<int> order;
+    vector<bool> used(cpus.size(), false);
+    auto take = [&](size_t k) { order.push_back(cpus[k].id); used[k] = true; };
+    switch (placement) {
+    case Placement::Compact:
+        for (size_t k = 0; k < cpus.size(); k++)
+            take(k);
+        break;
+    case Placement::Scatter: {
+        map<int, vector<size_t>> byPackage;
+        for (size_t k = 0; k < cpus.size(); k++)
+            if (cpus[k].primaryThread)
+                byPackage[cpus[k].package].push_back(k);
+        for (size_t round = 0; ; round++) {
+            bool any = false;
+            for (auto& [package, members] : byPackage) {
+                if (round < members.size()) {
+                    take(members[round]);
+                    any = true;
+                }
+            }
+            if (!any) break;
+        }
+        break;
+    }
+    case Placement::Physical:
+        for (size_t k = 0; k < cpus.size(); k++)
+            if (cpus[k].primaryThread)
+                take(k);
+        break;
+    case Placement::L2Cluster: {
+        set<int> clusters;
+        for (size_t k = 0; k < cpus.size(); k++)
+            if (clusters.insert(cpus[k].l2Cluster).second)
+                take(k);
+        break;
+    }
+    }
+    for (size_t k = 0; k < cpus.size(); k++)
+        if (!used[k])
+            order.push_back(cpus[k].id);
+    return order;
+}
+
+size_t calculateOptimalBlockSize(int l1CacheSizeKB, int associativity, int cacheLineSize, size_t n) {
+    size_t l1CacheSizeBytes = static_cast<size_t>(l1CacheSizeKB) * 1024;
+    size_t maxBlockSizeBytes = l1CacheSizeBytes / 2;
+    size_t maxElementsPerBlock = maxBlockSizeBytes / sizeof(int);
+    size_t maxBlockSide = static_cast<size_t>(sqrt(static_cast<double>(maxElementsPerBlock)));
+    size_t elementsPerCacheLine = cacheLineSize / sizeof(int);
+    size_t alignedBlockSide = maxBlockSide - (maxBlockSide % elementsPerCacheLine);
 
-    while (linesPerBlock > numSets * (associativity / 2)) {
+    size_t totalCacheLines = l1CacheSizeBytes / cacheLineSize;
+    size_t numSets = totalCacheLines / associativity;
+    size_t linesPerBlock = (alignedBlockSide * alignedBlockSide * sizeof(int)) / cacheLineSize;
+
+    while (alignedBlockSide > elementsPerCacheLine && linesPerBlock > numSets * (associativity / 2)) {
         alignedBlockSide -= elementsPerCacheLine;
         linesPerBlock = (alignedBlockSide * alignedBlockSide * sizeof(int)) / cacheLineSize;
     }
@@ -147,82 +952,3854 @@ int calculateOptimalBlockSize(int l1CacheSizeKB, int associativity, int cacheLin
     return max(alignedBlockSide, elementsPerCacheLine);
 }
 
-void naiveTransposeMatrix(const vector<vector<int>>& A, vector<vector<int>>& B, int n) {
-    for (int i = 0; i < n; i++) {
-        for (int j = 0; j < n; j++) {
+struct TileShape {
+    size_t rows;
+    size_t cols;
+};
+
+// Largest number of lines any cache set receives when `rowsInFlight` rows of `rowBytes` bytes,
+// `strideBytes` apart, are resident at once.
+size_t maxSetOccupancy(size_t rowsInFlight, size_t rowBytes, size_t strideBytes, size_t cacheLineSize, size_t numSets) {
+    vector<size_t> perSet(numSets, 0);
+    for (size_t r = 0; r < rowsInFlight; r++) {
+        size_t first = r * strideBytes / cacheLineSize;
+        size_t last = (r * strideBytes + rowBytes - 1) / cacheLineSize;
+        for (size_t line = first; line <= last; line++)
+            perSet[line % numSets]++;
+    }
+    return *max_element(perSet.begin(), perSet.end());
+}
+
+// Searches bh x bw tiles (both multiples of a cache line) that keep the tile within half of L1,
+// whose A rows plus B rows fit the associativity, and, once rows are a page apart, whose rows in
+// flight fit the dTLB. The largest tile wins; ties go to the wider tile, i.e. longer runs along A.
+TileShape calculateOptimalTileShape(int l1CacheSizeKB, int associativity, int cacheLineSize, size_t n, size_t tlbEntries = 64) {
+    size_t l1CacheSizeBytes = static_cast<size_t>(l1CacheSizeKB) * 1024;
+    size_t elementsPerCacheLine = cacheLineSize / sizeof(int);
+    size_t totalCacheLines = l1CacheSizeBytes / cacheLineSize;
+    size_t numSets = totalCacheLines / associativity;
+    size_t strideBytes = n * sizeof(int);
+    size_t maxSide = max(elementsPerCacheLine, min<size_t>(n, 1024));
+
+    TileShape best = { 0, 0 };
+    TileShape bestIgnoringConflicts = { 0, 0 };
+    auto better = [](TileShape a, TileShape b) {
+        size_t areaA = a.rows * a.cols, areaB = b.rows * b.cols;
+        return areaA != areaB ? areaA > areaB : a.cols > b.cols;
+    };
+    for (size_t bh = elementsPerCacheLine; bh <= maxSide; bh += elementsPerCacheLine) {
+        for (size_t bw = elementsPerCacheLine; bw <= maxSide; bw += elementsPerCacheLine) {
+            size_t linesPerTile = bh * bw * sizeof(int) / cacheLineSize;
+            if (linesPerTile > numSets * (associativity / 2)) continue;
+            if (strideBytes >= 4096 && bh + bw > tlbEntries) continue;
+            TileShape candidate = { bh, bw };
+            if (better(candidate, bestIgnoringConflicts))
+                bestIgnoringConflicts = candidate;
+            size_t occupancy = maxSetOccupancy(bh, bw * sizeof(int), strideBytes, cacheLineSize, numSets)
+                          + maxSetOccupancy(bw, bh * sizeof(int), strideBytes, cacheLineSize, numSets);
+            if (occupancy <= static_cast<size_t>(associativity) && better(candidate, best))
+                best = candidate;
+        }
+    }
+    if (best.rows == 0)
+        best = bestIgnoringConflicts;
+    if (best.rows == 0)
+        best = { elementsPerCacheLine, elementsPerCacheLine };
+    return best;
+}
+
+// Value makeIndexMatrix stores at (i, j). Up to n = 46340 it is i * n + j, unique per element.
+// Past that, i * n + j would wrap in an int and repeat, so the position is run through a 64-bit
+// mixer (splitmix64's finaliser) and truncated instead: any misplaced element still shows up with
+// probability 1 - 2^-32.
+inline int indexValue(size_t i, size_t j, size_t n) {
+    if (n <= 46340)
+        return static_cast<int>(i * n + j);
+    uint64_t x = (static_cast<uint64_t>(i) << 32) ^ static_cast<uint64_t>(j);
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return static_cast<int>(static_cast<uint32_t>(x ^ (x >> 31)));
+}
+
+vector<vector<int>> makeIndexMatrix(size_t n) {
+    vector<vector<int>> A(n, vector<int>(n));
+    for (size_t i = 0; i < n; i++)
+        for (size_t j = 0; j < n; j++)
+            A[i][j] = indexValue(i, j, n);
+    return A;
+}
+
+void naiveTransposeMatrix(const vector<vector<int>>& A, vector<vector<int>>& B, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = 0; j < n; j++) {
             B[j][i] = A[i][j];
         }
     }
 }
 
-void blockTransposeMatrix(const vector<vector<int>>& A, vector<vector<int>>& B, int n, int blockSize) {
-    for (int i = 0; i < n; i += blockSize) {
-        for (int j = 0; j < n; j += blockSize) {
-            for (int bi = i; bi < i + blockSize && bi < n; bi++) {
-                for (int bj = j; bj < j + blockSize && bj < n; bj++) {
-                    B[bj][bi] = A[bi][bj];
+enum class TileOrder { Row, Column, Morton, Hilbert };
+
+const char* tileOrderName(TileOrder order) {
+    switch (order) {
+    case TileOrder::Row:     return "row";
+    case TileOrder::Column:  return "column";
+    case TileOrder::Morton:  return "morton";
+    case TileOrder::Hilbert: return "hilbert";
+    }
+    return "?";
+}
+
+bool parseTileOrder(const string& text, TileOrder& order) {
+    for (auto candidate : { TileOrder::Row, TileOrder::Column, TileOrder::Morton, TileOrder::Hilbert }) {
+        if (text == tileOrderName(candidate)) {
+            order = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline size_t compactEvenBits(uint64_t x) {
+    x &= 0x5555555555555555ULL;
+    x = (x | (x >> 1)) & 0x3333333333333333ULL;
+    x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0FULL;
+    x = (x | (x >> 4)) & 0x00FF00FF00FF00FFULL;
+    x = (x | (x >> 8)) & 0x0000FFFF0000FFFFULL;
+    x = (x | (x >> 16)) & 0x00000000FFFFFFFFULL;
+    return static_cast<size_t>(x);
+}
+
+// Maps the index-th step of a curve over a side x side grid (side a power of two) to tile coordinates.
+void tileAt(TileOrder order, uint64_t index, size_t side, size_t& ti, size_t& tj) {
+    switch (order) {
+    case TileOrder::Row:
+        ti = static_cast<size_t>(index / side);
+        tj = static_cast<size_t>(index % side);
+        return;
+    case TileOrder::Column:
+        tj = static_cast<size_t>(index / side);
+        ti = static_cast<size_t>(index % side);
+        return;
+    case TileOrder::Morton:
+        tj = compactEvenBits(index);
+        ti = compactEvenBits(index >> 1);
+        return;
+    case TileOrder::Hilbert: {
+        size_t x = 0, y = 0;
+        for (size_t s = 1; s < side; s *= 2) {
+            size_t rx = 1 & static_cast<size_t>(index / 2);
+            size_t ry = 1 & static_cast<size_t>(index ^ rx);
+            if (ry == 0) {
+                if (rx == 1) {
+                    x = s - 1 - x;
+                    y = s - 1 - y;
                 }
+                swap(x, y);
             }
+            x += s * rx;
+            y += s * ry;
+            index /= 4;
         }
+        ti = y;
+        tj = x;
+        return;
+    }
     }
 }
 
-auto measureTime(const vector<vector<int>>& A, vector<vector<int>>& B, int n, int blockSize, bool useBlock) {
-    auto timer = zen::timer();
-    timer.start();
-    if (useBlock)
-        blockTransposeMatrix(A, B, n, blockSize);
-    else
-        naiveTransposeMatrix(A, B, n);
-    timer.stop();
-    return timer.duration<zen::timer::nsec>().count();
+#ifndef TRANSPOSE_PROBES
+#define TRANSPOSE_PROBES 0
+#endif
+
+enum class Stage { TileLoop, EdgeTiles, Pack, WriteOut, Count };
+
+const char* stageName(Stage stage) {
+    switch (stage) {
+    case Stage::TileLoop:  return "tile loop";
+    case Stage::EdgeTiles: return "edge tiles";
+    case Stage::Pack:      return "pack";
+    case Stage::WriteOut:  return "write-out";
+    case Stage::Count:     break;
+    }
+    return "?";
 }
 
+// Per-thread stage counters. Each thread only ever writes its own slot (relaxed atomics, no locks);
+// the mutex is taken once per thread on registration and when a report merges the slots.
+class ProbeRegistry {
+public:
+    struct Slot {
+        array<atomic<uint64_t>, static_cast<size_t>(Stage::Count)> calls{};
+        array<atomic<uint64_t>, static_cast<size_t>(Stage::Count)> nanoseconds{};
+    };
 
-int main(int argc, char** argv) {
-    zen::cmd_args args(argv, argc);
-    int n = 512;
-    if (args.is_present("--n")) {
-        auto num = std::stoi(args.get_options("--n")[0]);
-        if (num > 0)
-            n = num;
+    static ProbeRegistry& instance() {
+        static ProbeRegistry registry;
+        return registry;
     }
-    int selectedCore = selectPerformanceCore();
-    if (!pinToCore(selectedCore))
-        cerr << "Failed to pin to core " << selectedCore << ". Continuing without affinity." << endl;
-    else
-        cout << "Pinned to core " << selectedCore << endl;
 
-    int l1CacheSizeKB, associativity, cacheLineSize;
-    getCacheParameters(l1CacheSizeKB, associativity, cacheLineSize);
+    Slot& local() {
+        thread_local Slot* slot = nullptr;
+        if (!slot) {
+            lock_guard<mutex> lock(mutex_);
+            slots_.push_back(make_unique<Slot>());
+            slot = slots_.back().get();
+        }
+        return *slot;
+    }
 
-    int optimalBlockSize = calculateOptimalBlockSize(l1CacheSizeKB, associativity, cacheLineSize, n);
-    vector<vector<int>> A(n, vector<int>(n));
-    vector<vector<int>> B(n, vector<int>(n, 0));
-    for (int i = 0; i < n; i++)
-        for (int j = 0; j < n; j++)
-            A[i][j] = i * n + j;
-    vector<vector<int>> B_naive = B;
-    double naiveTime = measureTime(A, B_naive, n, 0, false);
-    double blockTime = measureTime(A, B, n, optimalBlockSize, true);
+    void record(Stage stage, uint64_t ns) {
+        Slot& slot = local();
+        size_t s = static_cast<size_t>(stage);
+        slot.calls[s].store(slot.calls[s].load(memory_order_relaxed) + 1, memory_order_relaxed);
+        slot.nanoseconds[s].store(slot.nanoseconds[s].load(memory_order_relaxed) + ns, memory_order_relaxed);
+    }
 
-    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
-    cout << " " << setw(18) << left << "Matrix Size (n)" 
-         << setw(20) << "L1 Cache (KB)" 
-         << setw(20) << "Associativity" 
-         << setw(20) << "Cache Line (B)" 
-         << setw(20) << "Naive Time (ns)" 
-         << setw(20) << "Block Time (ns)" 
-         << setw(20) << "Ratio (Naive/Block)" << endl;
-    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
-    cout << " " << setw(18) << left << n 
-         << setw(20) << l1CacheSizeKB 
-         << setw(20) << associativity 
-         << setw(20) << cacheLineSize 
-         << setw(20) << fixed << setprecision(2) << (naiveTime / 1000.0)
-         << setw(20) << fixed << setprecision(2) << (blockTime / 1000.0)
-         << setw(20) << fixed << setprecision(2) << (naiveTime / blockTime) << endl;
-    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    void reset() {
+        lock_guard<mutex> lock(mutex_);
+        for (auto& slot : slots_) {
+            for (auto& c : slot->calls) c.store(0, memory_order_relaxed);
+            for (auto& t : slot->nanoseconds) t.store(0, memory_order_relaxed);
+        }
+    }
+
+    void report(ostream& out) {
+        lock_guard<mutex> lock(mutex_);
+        out << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+        out << " " << setw(18) << left << "Stage"
+            << setw(20) << "Calls"
+            << setw(20) << "Total (ns)"
+            << setw(20) << "Per Call (ns)"
+            << setw(20) << "Threads" << endl;
+        out << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+        for (size_t s = 0; s < static_cast<size_t>(Stage::Count); s++) {
+            uint64_t calls = 0, ns = 0, threads = 0;
+            for (auto& slot : slots_) {
+                uint64_t slotCalls = slot->calls[s].load(memory_order_relaxed);
+                calls += slotCalls;
+                ns += slot->nanoseconds[s].load(memory_order_relaxed);
+                threads += slotCalls > 0;
+            }
+            out << " " << setw(18) << left << stageName(static_cast<Stage>(s))
+                << setw(20) << calls
+                << setw(20) << ns
+                << setw(20) << fixed << setprecision(2) << (calls ? static_cast<double>(ns) / calls : 0.0)
+                << setw(20) << threads << endl;
+        }
+        out << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    }
+
+private:
+    mutex mutex_;
+    vector<unique_ptr<Slot>> slots_;
+};
+
+// The timer is only constructed (and the counter only read) when the probe is active, so an
+// inactive TRANSPOSE_PROBE_IF costs a branch inside the tile loop and nothing more.
+class ScopedProbe {
+public:
+    explicit ScopedProbe(Stage stage, bool active = true) : stage_(stage) {
+        if (active) timer_.emplace().start();
+    }
+    ~ScopedProbe() {
+        if (!timer_) return;
+        timer_->stop();
+        ProbeRegistry::instance().record(stage_, timer_->duration<zen::timer::nsec>().count());
+    }
+    ScopedProbe(const ScopedProbe&) = delete;
+    ScopedProbe& operator=(const ScopedProbe&) = delete;
+
+private:
+    Stage stage_;
+    optional<zen::timer> timer_;
+};
+
+#define PROBE_CONCAT_(a, b) a##b
+#define PROBE_CONCAT(a, b) PROBE_CONCAT_(a, b)
+#if TRANSPOSE_PROBES
+#define TRANSPOSE_PROBE(stage) ScopedProbe PROBE_CONCAT(probe_, __LINE__)(stage)
+#define TRANSPOSE_PROBE_IF(stage, condition) ScopedProbe PROBE_CONCAT(probe_, __LINE__)(stage, condition)
+#else
+#define TRANSPOSE_PROBE(stage) do { } while (0)
+#define TRANSPOSE_PROBE_IF(stage, condition) do { } while (0)
+#endif
+
+// Direct writes B straight from the tile loop. Bounce transposes each tile into an aligned L1-resident
+// buffer first and then copies whole rows of it into B, optionally with non-temporal stores.
+enum class TileWrite { Direct, Bounce, BounceNonTemporal };
+
+const char* tileWriteName(TileWrite write) {
+    switch (write) {
+    case TileWrite::Direct:            return "direct";
+    case TileWrite::Bounce:            return "bounce";
+    case TileWrite::BounceNonTemporal: return "bounce + nt";
+    }
+    return "?";
+}
+
+// Calls visit(i, iEnd, j, jEnd) for every tile of an n x n matrix in the given traversal order.
+template<class Visit>
+void forEachTile(size_t n, TileShape tile, TileOrder order, Visit visit) {
+    if (order == TileOrder::Row) {
+        for (size_t i = 0; i < n; i += tile.rows)
+            for (size_t j = 0; j < n; j += tile.cols)
+                visit(i, min(i + tile.rows, n), j, min(j + tile.cols, n));
+        return;
+    }
+
+    // Morton and Hilbert curves cover a power-of-two grid; tiles past the matrix edge are skipped.
+    size_t tileRows = (n + tile.rows - 1) / tile.rows;
+    size_t tileCols = (n + tile.cols - 1) / tile.cols;
+    size_t side = 1;
+    while (side < max(tileRows, tileCols))
+        side *= 2;
+    uint64_t steps = static_cast<uint64_t>(side) * side;
+    for (uint64_t index = 0; index < steps; index++) {
+        size_t ti, tj;
+        tileAt(order, index, side, ti, tj);
+        if (ti >= tileRows || tj >= tileCols) continue;
+        size_t i = ti * tile.rows, j = tj * tile.cols;
+        visit(i, min(i + tile.rows, n), j, min(j + tile.cols, n));
+    }
+}
+
+// Streams src into dst. B's rows are not cache-line aligned, so the prologue peels dst up to a
+// 64-byte boundary and only whole lines are streamed; the partial lines at either end go through
+// the cache instead of becoming partial-line non-temporal writes. src is read unaligned.
+void copyRow(int* dst, const int* src, size_t count, bool nonTemporal) {
+#ifdef HAS_SSE2
+    if (nonTemporal) {
+        size_t k = 0;
+        for (; k < count && (reinterpret_cast<uintptr_t>(dst + k) & 63) != 0; k++)
+            dst[k] = src[k];
+        for (; k + 16 <= count; k += 16) {
+            __m128i* line = reinterpret_cast<__m128i*>(dst + k);
+            const __m128i* from = reinterpret_cast<const __m128i*>(src + k);
+            _mm_stream_si128(line, _mm_loadu_si128(from));
+            _mm_stream_si128(line + 1, _mm_loadu_si128(from + 1));
+            _mm_stream_si128(line + 2, _mm_loadu_si128(from + 2));
+            _mm_stream_si128(line + 3, _mm_loadu_si128(from + 3));
+        }
+        for (; k < count; k++)
+            dst[k] = src[k];
+        return;
+    }
+#else
+    (void)nonTemporal;
+#endif
+    memcpy(dst, src, count * sizeof(int));
+}
+
+// The bounce buffer holds a tile in B's orientation; its pitch is rounded to a cache line (and
+// kept off a multiple of the L1 way size) so the strided fill stays conflict-free.
+size_t bouncePitch(TileShape tile) {
+    size_t pitch = (tile.rows + 15) / 16 * 16;
+    if (pitch % 1024 == 0)
+        pitch += 16;
+    return pitch;
+}
+
+// Ints of scratch bounceTransposeMatrix needs, including slack for cache-line alignment.
+size_t bounceScratchSize(TileShape tile) {
+    return bouncePitch(tile) * tile.cols + 16;
+}
+
+void bounceTransposeMatrix(const vector<vector<int>>& A, vector<vector<int>>& B, size_t n, TileShape tile,
+                           TileOrder order, bool nonTemporal, int* scratch);
+
+void blockTransposeMatrix(const vector<vector<int>>& A, vector<vector<int>>& B, size_t n, TileShape tile,
+                          TileOrder order = TileOrder::Row, TileWrite write = TileWrite::Direct) {
+    TRANSPOSE_PROBE(Stage::TileLoop);
+    if (write == TileWrite::Direct) {
+        forEachTile(n, tile, order, [&](size_t i, size_t iEnd, size_t j, size_t jEnd) {
+            TRANSPOSE_PROBE_IF(Stage::EdgeTiles, iEnd - i < tile.rows || jEnd - j < tile.cols);
+            for (size_t bi = i; bi < iEnd; bi++) {
+                for (size_t bj = j; bj < jEnd; bj++) {
+                    B[bj][bi] = A[bi][bj];
+                }
+            }
+        });
+        return;
+    }
+
+    vector<int> storage(bounceScratchSize(tile));
+    bounceTransposeMatrix(A, B, n, tile, order, write == TileWrite::BounceNonTemporal, storage.data());
+}
+
+void blockTransposeMatrix(const vector<vector<int>>& A, vector<vector<int>>& B, size_t n, size_t blockSize,
+                          TileOrder order = TileOrder::Row, TileWrite write = TileWrite::Direct) {
+    blockTransposeMatrix(A, B, n, TileShape{ blockSize, blockSize }, order, write);
+}
+
+void bounceTransposeMatrix(const vector<vector<int>>& A, vector<vector<int>>& B, size_t n, TileShape tile,
+                           TileOrder order, bool nonTemporal, int* scratch) {
+    size_t pitch = bouncePitch(tile);
+    int* buffer = reinterpret_cast<int*>((reinterpret_cast<uintptr_t>(scratch) + 63) & ~uintptr_t(63));
+    forEachTile(n, tile, order, [&](size_t i, size_t iEnd, size_t j, size_t jEnd) {
+        TRANSPOSE_PROBE_IF(Stage::EdgeTiles, iEnd - i < tile.rows || jEnd - j < tile.cols);
+        {
+            TRANSPOSE_PROBE(Stage::Pack);
+            for (size_t bi = i; bi < iEnd; bi++) {
+                const int* row = A[bi].data();
+                for (size_t bj = j; bj < jEnd; bj++) {
+                    buffer[(bj - j) * pitch + (bi - i)] = row[bj];
+                }
+            }
+        }
+        TRANSPOSE_PROBE(Stage::WriteOut);
+        for (size_t bj = j; bj < jEnd; bj++)
+            copyRow(B[bj].data() + i, buffer + (bj - j) * pitch, iEnd - i, nonTemporal);
+    });
+#ifdef HAS_SSE2
+    if (nonTemporal)
+        _mm_sfence();
+#endif
+}
+
+// Cache-oblivious transpose: halves the longer side of the block until it is at most 32 x 32, so
+// every cache level eventually sees a working set that fits, without knowing any cache size.
+void recursiveTransposeBlock(const vector<vector<int>>& A, vector<vector<int>>& B,
+                             size_t i0, size_t i1, size_t j0, size_t j1) {
+    if (i1 - i0 <= 32 && j1 - j0 <= 32) {
+        for (size_t i = i0; i < i1; i++)
+            for (size_t j = j0; j < j1; j++)
+                B[j][i] = A[i][j];
+    } else if (i1 - i0 >= j1 - j0) {
+        size_t mid = i0 + (i1 - i0) / 2;
+        recursiveTransposeBlock(A, B, i0, mid, j0, j1);
+        recursiveTransposeBlock(A, B, mid, i1, j0, j1);
+    } else {
+        size_t mid = j0 + (j1 - j0) / 2;
+        recursiveTransposeBlock(A, B, i0, i1, j0, mid);
+        recursiveTransposeBlock(A, B, i0, i1, mid, j1);
+    }
+}
+
+void recursiveTransposeMatrix(const vector<vector<int>>& A, vector<vector<int>>& B, size_t n) {
+    recursiveTransposeBlock(A, B, 0, n, 0, n);
+}
+
+// Transposes A onto itself: diagonal tiles are transposed in place, and each tile pair (I, J) /
+// (J, I) above the diagonal is swapped element-wise, so only one n x n matrix is ever resident.
+void inPlaceBlockTransposeMatrix(vector<vector<int>>& A, size_t n, size_t blockSize) {
+    for (size_t ii = 0; ii < n; ii += blockSize) {
+        size_t iEnd = min(ii + blockSize, n);
+        for (size_t jj = ii; jj < n; jj += blockSize) {
+            size_t jEnd = min(jj + blockSize, n);
+            for (size_t i = ii; i < iEnd; i++)
+                for (size_t j = max(jj, i + 1); j < jEnd; j++)
+                    swap(A[i][j], A[j][i]);
+        }
+    }
+}
+
+void naiveInPlaceTransposeMatrix(vector<vector<int>>& A, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        for (size_t j = i + 1; j < n; j++)
+            swap(A[i][j], A[j][i]);
+}
+
+void blockTransposeStrided(const int* src, size_t srcStride, int* dst, size_t dstStride,
+                           size_t rows, size_t cols, size_t blockSize) {
+    for (size_t i = 0; i < rows; i += blockSize) {
+        size_t iEnd = min(i + blockSize, rows);
+        for (size_t j = 0; j < cols; j += blockSize) {
+            size_t jEnd = min(j + blockSize, cols);
+            for (size_t bi = i; bi < iEnd; bi++) {
+                for (size_t bj = j; bj < jEnd; bj++) {
+                    dst[bj * dstStride + bi] = src[bi * srcStride + bj];
+                }
+            }
+        }
+    }
+}
+
+vector<size_t> rowMajorStrides(const vector<size_t>& shape) {
+    vector<size_t> strides(shape.size(), 1);
+    for (size_t k = shape.size(); k-- > 1;)
+        strides[k - 1] = strides[k] * shape[k];
+    return strides;
+}
+
+size_t elementCount(const vector<size_t>& shape) {
+    size_t count = 1;
+    for (size_t extent : shape)
+        count *= extent;
+    return count;
+}
+
+// Drops unit axes and merges axes that stay adjacent and in order after the permutation,
+// so e.g. (0,2,3,1) on NCHW becomes a batch of (C x HW) -> (HW x C) transposes.
+void simplifyPermutation(const vector<size_t>& shape, const vector<int>& perm,
+                         vector<size_t>& outShape, vector<int>& outPerm) {
+    vector<int> keptPerm;
+    vector<int> newIndex(shape.size(), -1);
+    for (size_t a = 0, kept = 0; a < shape.size(); a++)
+        if (shape[a] != 1)
+            newIndex[a] = static_cast<int>(kept++);
+    for (int a : perm)
+        if (newIndex[a] >= 0)
+            keptPerm.push_back(newIndex[a]);
+    vector<size_t> keptShape;
+    for (size_t extent : shape)
+        if (extent != 1)
+            keptShape.push_back(extent);
+
+    vector<vector<int>> groups;
+    for (size_t k = 0; k < keptPerm.size(); k++) {
+        if (!groups.empty() && groups.back().back() + 1 == keptPerm[k])
+            groups.back().push_back(keptPerm[k]);
+        else
+            groups.push_back({ keptPerm[k] });
+    }
+
+    vector<size_t> order(groups.size());
+    for (size_t g = 0; g < groups.size(); g++)
+        order[g] = g;
+    sort(order.begin(), order.end(), [&](size_t x, size_t y) { return groups[x][0] < groups[y][0]; });
+
+    outShape.assign(groups.size(), 1);
+    outPerm.assign(groups.size(), 0);
+    for (size_t rank = 0; rank < order.size(); rank++) {
+        for (int a : groups[order[rank]])
+            outShape[rank] *= keptShape[a];
+        outPerm[order[rank]] = static_cast<int>(rank);
+    }
+    if (outShape.empty()) {
+        outShape = { 1 };
+        outPerm = { 0 };
+    }
+}
+
+bool isValidPermutation(const vector<int>& perm, size_t rank) {
+    if (perm.size() != rank) return false;
+    vector<bool> seen(rank, false);
+    for (int a : perm) {
+        if (a < 0 || static_cast<size_t>(a) >= rank || seen[a]) return false;
+        seen[a] = true;
+    }
+    return true;
+}
+
+void naivePermuteTensor(const int* src, int* dst, const vector<size_t>& shape, const vector<int>& perm) {
+    size_t nd = shape.size();
+    vector<size_t> srcStrides = rowMajorStrides(shape);
+    vector<size_t> index(nd, 0);
+    size_t total = elementCount(shape);
+    for (size_t out = 0; out < total; out++) {
+        size_t offset = 0;
+        for (size_t k = 0; k < nd; k++)
+            offset += index[k] * srcStrides[perm[k]];
+        dst[out] = src[offset];
+        for (size_t k = nd; k-- > 0;) {
+            if (++index[k] < shape[perm[k]]) break;
+            index[k] = 0;
+        }
+    }
+}
+
+void permuteTensor(const int* src, int* dst, const vector<size_t>& fullShape, const vector<int>& fullPerm, size_t blockSize) {
+    if (elementCount(fullShape) == 0)
+        return;
+    vector<size_t> shape;
+    vector<int> perm;
+    simplifyPermutation(fullShape, fullPerm, shape, perm);
+
+    size_t nd = shape.size();
+    vector<size_t> dstShape(nd);
+    vector<size_t> outPos(nd);
+    for (size_t k = 0; k < nd; k++) {
+        dstShape[k] = shape[perm[k]];
+        outPos[perm[k]] = k;
+    }
+    vector<size_t> srcStrides = rowMajorStrides(shape);
+    vector<size_t> dstStrides = rowMajorStrides(dstShape);
+
+    size_t inner = nd - 1;
+    size_t tileRowAxis = static_cast<size_t>(perm[nd - 1]);
+    bool innerFixed = (tileRowAxis == inner);
+
+    vector<size_t> outer;
+    for (size_t k = 0; k < nd; k++) {
+        size_t a = static_cast<size_t>(perm[k]);
+        if (a != inner && a != tileRowAxis)
+            outer.push_back(a);
+    }
+
+    vector<size_t> index(outer.size(), 0);
+    while (true) {
+        size_t srcOffset = 0, dstOffset = 0;
+        for (size_t k = 0; k < outer.size(); k++) {
+            srcOffset += index[k] * srcStrides[outer[k]];
+            dstOffset += index[k] * dstStrides[outPos[outer[k]]];
+        }
+        if (innerFixed)
+            memcpy(dst + dstOffset, src + srcOffset, shape[inner] * sizeof(int));
+        else
+            blockTransposeStrided(src + srcOffset, srcStrides[tileRowAxis], dst + dstOffset, dstStrides[outPos[inner]],
+                                  shape[tileRowAxis], shape[inner], blockSize);
+
+        size_t k = outer.size();
+        while (k > 0) {
+            k--;
+            if (++index[k] < shape[outer[k]]) break;
+            index[k] = 0;
+            if (k == 0) return;
+        }
+        if (outer.empty()) return;
+    }
+}
+
+string formatPermutation(const vector<int>& perm) {
+    ostringstream out;
+    out << "(";
+    for (size_t k = 0; k < perm.size(); k++)
+        out << (k ? "," : "") << perm[k];
+    out << ")";
+    return out.str();
+}
+
+void runPermuteBenchmark(const vector<size_t>& shape, const vector<vector<int>>& patterns, size_t blockSize) {
+    size_t total = elementCount(shape);
+    vector<int> src(total), dstNaive(total), dst(total);
+    for (size_t i = 0; i < total; i++)
+        src[i] = static_cast<int>(i);
+
+    ostringstream shapeText;
+    for (size_t k = 0; k < shape.size(); k++)
+        shapeText << (k ? "x" : "") << shape[k];
+
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    cout << " " << setw(18) << left << "Permutation"
+         << setw(20) << "Shape"
+         << setw(20) << "Naive Time (ns)"
+         << setw(20) << "Permute Time (ns)"
+         << setw(20) << "Ratio (Naive/Perm)"
+         << setw(20) << "Throughput (GB/s)"
+         << setw(20) << "Correct" << endl;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    for (const auto& perm : patterns) {
+        if (!isValidPermutation(perm, shape.size())) {
+            cerr << "Skipping invalid permutation " << formatPermutation(perm) << " for a rank-" << shape.size() << " tensor" << endl;
+            continue;
+        }
+        auto timer = zen::timer();
+        timer.start();
+        naivePermuteTensor(src.data(), dstNaive.data(), shape, perm);
+        timer.stop();
+        double naiveTime = timer.duration<zen::timer::nsec>().count();
+
+        timer.start();
+        permuteTensor(src.data(), dst.data(), shape, perm, blockSize);
+        timer.stop();
+        double permuteTime = timer.duration<zen::timer::nsec>().count();
+
+        double gbPerSec = 2.0 * total * sizeof(int) / permuteTime;
+        cout << " " << setw(18) << left << formatPermutation(perm)
+             << setw(20) << shapeText.str()
+             << setw(20) << fixed << setprecision(2) << (naiveTime / 1000.0)
+             << setw(20) << fixed << setprecision(2) << (permuteTime / 1000.0)
+             << setw(20) << fixed << setprecision(2) << (naiveTime / permuteTime)
+             << setw(20) << fixed << setprecision(2) << gbPerSec
+             << setw(20) << (dst == dstNaive ? "yes" : "NO") << endl;
+    }
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+}
+
+// Optional timeline tracer. Every thread records complete events into its own preallocated ring
+// buffer (oldest events are overwritten once it is full); writeChromeTrace emits the Chrome/Perfetto
+// trace-event JSON that chrome://tracing or ui.perfetto.dev can open.
+class TraceRecorder {
+public:
+    struct Event {
+        const char* name;
+        uint64_t beginNs;
+        uint64_t endNs;
+        uint64_t item;
+    };
+
+    static TraceRecorder& instance() {
+        static TraceRecorder recorder;
+        return recorder;
+    }
+
+    // Preallocates `threads` rings up front so no thread allocates or resizes one inside a traced
+    // run; a thread that registers after the spares are used up still gets a ring of its own.
+    void enable(size_t eventsPerThread, size_t threads) {
+        {
+            lock_guard<mutex> lock(mutex_);
+            capacity_ = max<size_t>(eventsPerThread, 1);
+            for (size_t k = 0; k < threads; k++) {
+                spare_.push_back(make_unique<Ring>());
+                spare_.back()->events.resize(capacity_);
+            }
+        }
+        enabled_.store(true, memory_order_release);
+    }
+
+    // Claims the calling thread's ring now rather than on its first event. Worker threads call
+    // this when they start, which is before any timed run.
+    void registerThread() {
+        if (enabled())
+            local();
+    }
+
+    // Labels the calling thread "main" in the exported trace, whenever it records its first event.
+    void setMainThread() {
+        {
+            lock_guard<mutex> lock(mutex_);
+            mainThread_ = this_thread::get_id();
+        }
+        registerThread();
+    }
+
+    bool enabled() const { return enabled_.load(memory_order_acquire); }
+
+    uint64_t now() const {
+        return static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - epoch_).count());
+    }
+
+    void record(const char* name, uint64_t beginNs, uint64_t endNs, uint64_t item) {
+        Ring& ring = local();
+        ring.events[ring.written % ring.events.size()] = { name, beginNs, endNs, item };
+        ring.written++;
+    }
+
+    bool writeChromeTrace(const string& path) {
+        ofstream out(path);
+        if (!out) {
+            cerr << "Failed to open trace file " << path << endl;
+            return false;
+        }
+        lock_guard<mutex> lock(mutex_);
+        out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        bool first = true;
+        size_t dropped = 0;
+        for (const auto& ring : rings_) {
+            out << (first ? "" : ",") << "\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << ring->tid
+                << ",\"args\":{\"name\":\"" << (ring->owner == mainThread_ ? "main" : "worker " + to_string(ring->tid)) << "\"}}";
+            first = false;
+            size_t count = min(ring->written, ring->events.size());
+            dropped += ring->written - count;
+            for (size_t k = ring->written - count; k < ring->written; k++) {
+                const Event& event = ring->events[k % ring->events.size()];
+                out << ",\n{\"ph\":\"X\",\"cat\":\"transpose\",\"name\":\"" << event.name << "\",\"pid\":1,\"tid\":" << ring->tid
+                    << ",\"ts\":" << fixed << setprecision(3) << event.beginNs / 1000.0
+                    << ",\"dur\":" << (event.endNs - event.beginNs) / 1000.0
+                    << ",\"args\":{\"item\":" << event.item << "}}";
+            }
+        }
+        out << "\n]}\n";
+        cout << "Wrote trace with " << rings_.size() << " thread(s) to " << path;
+        if (dropped)
+            cout << " (" << dropped << " oldest events overwritten)";
+        cout << endl;
+        return true;
+    }
+
+private:
+    struct Ring {
+        vector<Event> events;
+        size_t written = 0;
+        unsigned tid = 0;
+        thread::id owner;
+    };
+
+    Ring& local() {
+        thread_local Ring* ring = nullptr;
+        if (!ring) {
+            lock_guard<mutex> lock(mutex_);
+            if (spare_.empty()) {
+                spare_.push_back(make_unique<Ring>());
+                spare_.back()->events.resize(capacity_);
+            }
+            rings_.push_back(move(spare_.back()));
+            spare_.pop_back();
+            ring = rings_.back().get();
+            ring->tid = static_cast<unsigned>(rings_.size() - 1);
+            ring->owner = this_thread::get_id();
+        }
+        return *ring;
+    }
+
+    atomic<bool> enabled_{ false };
+    size_t capacity_ = 1 << 16;
+    chrono::steady_clock::time_point epoch_ = chrono::steady_clock::now();
+    mutex mutex_;
+    vector<unique_ptr<Ring>> rings_;
+    vector<unique_ptr<Ring>> spare_;
+    thread::id mainThread_;
+};
+
+class TraceScope {
+public:
+    TraceScope(const char* name, uint64_t item = 0) : name_(name), item_(item), active_(TraceRecorder::instance().enabled()) {
+        if (active_) beginNs_ = TraceRecorder::instance().now();
+    }
+    ~TraceScope() {
+        if (active_)
+            TraceRecorder::instance().record(name_, beginNs_, TraceRecorder::instance().now(), item_);
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name_;
+    uint64_t item_;
+    bool active_;
+    uint64_t beginNs_ = 0;
+};
+
+// Hardware threads, narrowed to the affinity mask, the cgroup cpuset and the cgroup CPU quota
+// (rounded up) so a pool inside a container does not oversubscribe and get throttled.
+unsigned defaultThreadCount() {
+    unsigned count = thread::hardware_concurrency();
+    if (!allowedCpus().empty())
+        count = min<unsigned>(count, static_cast<unsigned>(allowedCpus().size()));
+    const ContainerLimits& limits = containerLimits();
+    if (limits.cpusetCount > 0)
+        count = min<unsigned>(count, static_cast<unsigned>(limits.cpusetCount));
+    if (limits.cpuQuota > 0)
+        count = min<unsigned>(count, static_cast<unsigned>(ceil(limits.cpuQuota)));
+    return count > 0 ? count : 1;
+}
+
+// Persistent workers, each pinned to its own CPU according to the placement policy. The calling
+// thread takes part in every job as worker 0 on the CPU it is already pinned to, so that CPU
+// heads the order and a pool of size N owns N - 1 threads spread over the rest. One job runs at
+// a time: concurrent run() calls are admitted in arrival order, and a run() from inside a job
+// executes its items inline on the calling thread.
+class WorkerPool {
+public:
+    static WorkerPool& shared() {
+        static WorkerPool pool;
+        return pool;
+    }
+
+    ~WorkerPool() { stop(); }
+
+    void configure(unsigned size, Placement placement) {
+        JobTicket ticket(*this);
+        configureLocked(size, placement);
+    }
+
+    unsigned size() const { return size_; }
+    Placement placement() const { return placement_; }
+
+    void run(size_t count, unsigned threads, const function<void(size_t)>& body, const char* traceName) {
+        run(count, threads, [](void* context, size_t i) { (*static_cast<const function<void(size_t)>*>(context))(i); },
+            const_cast<function<void(size_t)>*>(&body), traceName);
+    }
+
+    // The same job as a plain function pointer and context, for callers that bind their job once
+    // and must not build a std::function on every call.
+    void run(size_t count, unsigned threads, void (*body)(void*, size_t), void* context, const char* traceName) {
+        if (inJob()) {
+            // This thread's job already holds the pool; waiting for another turn would deadlock.
+            for (size_t i = 0; i < count; i++) {
+                TraceScope batch(traceName, i);
+                body(context, i);
+            }
+            return;
+        }
+        JobTicket ticket(*this);
+        if (size_ < threads)
+            configureLocked(threads, placement_);
+        {
+            lock_guard<mutex> lock(mutex_);
+            body_ = body;
+            context_ = context;
+            traceName_ = traceName;
+            count_ = count;
+            next_ = 0;
+            participants_ = min<unsigned>(threads, size_);
+            pending_ = participants_ - 1;
+            generation_++;
+        }
+        wake_.notify_all();
+        work();
+        unique_lock<mutex> lock(mutex_);
+        done_.wait(lock, [this] { return pending_ == 0; });
+        body_ = nullptr;
+        context_ = nullptr;
+    }
+
+private:
+    // Admits jobs (and reconfiguration) one at a time in arrival order. A plain mutex lets the
+    // releasing thread re-acquire it ahead of threads already waiting, so a caller that runs jobs
+    // back to back, such as the TransposeService driver, could starve every other pool user.
+    class JobTicket {
+    public:
+        explicit JobTicket(WorkerPool& pool) : pool_(pool) {
+            unique_lock<mutex> lock(pool_.admitMutex_);
+            uint64_t ticket = pool_.nextTicket_++;
+            pool_.admitted_.wait(lock, [&] { return pool_.serving_ == ticket; });
+        }
+        ~JobTicket() {
+            {
+                lock_guard<mutex> lock(pool_.admitMutex_);
+                pool_.serving_++;
+            }
+            pool_.admitted_.notify_all();
+        }
+        JobTicket(const JobTicket&) = delete;
+        JobTicket& operator=(const JobTicket&) = delete;
+
+    private:
+        WorkerPool& pool_;
+    };
+
+    // Callers hold a JobTicket, so no job is in flight while the workers are replaced.
+    void configureLocked(unsigned size, Placement placement) {
+        stop();
+        placement_ = placement;
+        vector<int> cpus = placementOrder(placement);
+        int caller = currentCpu();
+        if (caller >= 0) {
+            cpus.erase(remove(cpus.begin(), cpus.end(), caller), cpus.end());
+            cpus.insert(cpus.begin(), caller);
+        }
+        shutdown_ = false;
+        for (unsigned k = 1; k < max(size, 1u); k++) {
+            int cpu = cpus.empty() ? -1 : cpus[k % cpus.size()];
+            workers_.emplace_back([this, k, cpu] { workerLoop(k, cpu); });
+        }
+        if (!cpus.empty() && size > 1) {
+            cout << "Worker placement (" << placementName(placement) << "):";
+            for (unsigned k = 1; k < size; k++)
+                cout << " " << cpus[k % cpus.size()];
+            cout << endl;
+        }
+        size_ = static_cast<unsigned>(workers_.size()) + 1;
+    }
+
+    static bool& inJob() {
+        thread_local bool inside = false;
+        return inside;
+    }
+
+    void work() {
+        TraceScope span("worker");
+        inJob() = true;
+        for (size_t i = next_++; i < count_; i = next_++) {
+            TraceScope batch(traceName_, i);
+            body_(context_, i);
+        }
+        inJob() = false;
+    }
+
+    void workerLoop(unsigned index, int cpu) {
+        if (cpu >= 0)
+            pinToCore(cpu);
+        TraceRecorder::instance().registerThread();
+        uint64_t seen = 0;
+        while (true) {
+            {
+                unique_lock<mutex> lock(mutex_);
+                wake_.wait(lock, [&] { return shutdown_ || generation_ != seen; });
+                if (shutdown_) return;
+                seen = generation_;
+                if (index >= participants_) continue;
+            }
+            work();
+            {
+                lock_guard<mutex> lock(mutex_);
+                pending_--;
+            }
+            done_.notify_one();
+        }
+    }
+
+    void stop() {
+        {
+            lock_guard<mutex> lock(mutex_);
+            shutdown_ = true;
+        }
+        wake_.notify_all();
+        for (auto& worker : workers_)
+            worker.join();
+        workers_.clear();
+        size_ = 1;
+    }
+
+    mutex admitMutex_;
+    condition_variable admitted_;
+    uint64_t nextTicket_ = 0;
+    uint64_t serving_ = 0;
+    mutex mutex_;
+    condition_variable wake_;
+    condition_variable done_;
+    vector<thread> workers_;
+    atomic<unsigned> size_{ 1 };
+    atomic<Placement> placement_{ Placement::Compact };
+    bool shutdown_ = false;
+    uint64_t generation_ = 0;
+    unsigned participants_ = 0;
+    unsigned pending_ = 0;
+    void (*body_)(void*, size_t) = nullptr;
+    void* context_ = nullptr;
+    const char* traceName_ = "batch";
+    size_t count_ = 0;
+    atomic<size_t> next_{ 0 };
+};
+
+template<class Body>
+void parallelFor(size_t count, unsigned threadCount, Body body, const char* traceName = "batch") {
+    size_t workers = min<size_t>(max(threadCount, 1u), count);
+    if (workers <= 1) {
+        TraceScope span("worker");
+        for (size_t i = 0; i < count; i++) {
+            TraceScope batch(traceName, i);
+            body(i);
+        }
+        return;
+    }
+    function<void(size_t)> task = body;
+    WorkerPool::shared().run(count, static_cast<unsigned>(workers), task, traceName);
+}
+
+// Transposes band `band` (rows [band * tile.rows, + tile.rows) of A) tile by tile.
+void blockTransposeBand(const vector<vector<int>>& A, vector<vector<int>>& B, size_t n, TileShape tile, size_t band) {
+    size_t i = band * tile.rows;
+    size_t iEnd = min(i + tile.rows, n);
+    for (size_t j = 0; j < n; j += tile.cols) {
+        size_t jEnd = min(j + tile.cols, n);
+        for (size_t bi = i; bi < iEnd; bi++) {
+            for (size_t bj = j; bj < jEnd; bj++) {
+                B[bj][bi] = A[bi][bj];
+            }
+        }
+    }
+}
+
+// Splits the blocked transpose into bands of tile.rows rows of A; each band is one work item.
+void parallelBlockTransposeMatrix(const vector<vector<int>>& A, vector<vector<int>>& B, size_t n, TileShape tile, unsigned threadCount) {
+    size_t bands = (n + tile.rows - 1) / tile.rows;
+    parallelFor(bands, threadCount, [&](size_t band) { blockTransposeBand(A, B, n, tile, band); }, "tile band");
+}
+
+#ifdef HAS_SSE2
+inline void transpose4x4(__m128i& r0, __m128i& r1, __m128i& r2, __m128i& r3) {
+    __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+    __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+    __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+    __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+    r0 = _mm_unpacklo_epi64(t0, t1);
+    r1 = _mm_unpackhi_epi64(t0, t1);
+    r2 = _mm_unpacklo_epi64(t2, t3);
+    r3 = _mm_unpackhi_epi64(t2, t3);
+}
+#endif
+
+// n x n transpose for a compile-time n: the row pointers live on the stack, every loop bound is a
+// constant (how far each loop unrolls is left to the compiler), and with SSE2 the 4-aligned part
+// moves 4x4 blocks through registers. No heap allocation, no cache model, no threads.
+template<size_t N>
+void smallTransposeFixed(const vector<vector<int>>& A, vector<vector<int>>& B) {
+    array<const int*, N> src;
+    array<int*, N> dst;
+    for (size_t k = 0; k < N; k++) {
+        src[k] = A[k].data();
+        dst[k] = B[k].data();
+    }
+    constexpr size_t aligned = N / 4 * 4;
+#ifdef HAS_SSE2
+    for (size_t i = 0; i < aligned; i += 4) {
+        for (size_t j = 0; j < aligned; j += 4) {
+            __m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src[i] + j));
+            __m128i r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src[i + 1] + j));
+            __m128i r2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src[i + 2] + j));
+            __m128i r3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src[i + 3] + j));
+            transpose4x4(r0, r1, r2, r3);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst[j] + i), r0);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst[j + 1] + i), r1);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst[j + 2] + i), r2);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst[j + 3] + i), r3);
+        }
+    }
+    constexpr size_t scalarFrom = aligned;
+#else
+    constexpr size_t scalarFrom = 0;
+#endif
+    // Rows below the SIMD square in full, then the columns to its right.
+    for (size_t i = scalarFrom; i < N; i++)
+        for (size_t j = 0; j < N; j++)
+            dst[j][i] = src[i][j];
+    for (size_t i = 0; i < scalarFrom; i++)
+        for (size_t j = scalarFrom; j < N; j++)
+            dst[j][i] = src[i][j];
+}
+
+// Blocked transpose that walks each tile in 4x4 register blocks. Tile sides are rounded up to a
+// multiple of 4; the rows and columns past the last multiple of 4 are copied with scalar code.
+void simdBlockTransposeMatrix(const vector<vector<int>>& A, vector<vector<int>>& B, size_t n, TileShape tile) {
+#ifdef HAS_SSE2
+    size_t aligned = n / 4 * 4;
+    TileShape rounded = { (tile.rows + 3) / 4 * 4, (tile.cols + 3) / 4 * 4 };
+    forEachTile(aligned, rounded, TileOrder::Row, [&](size_t i, size_t iEnd, size_t j, size_t jEnd) {
+        for (size_t bi = i; bi < iEnd; bi += 4) {
+            for (size_t bj = j; bj < jEnd; bj += 4) {
+                __m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(A[bi].data() + bj));
+                __m128i r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(A[bi + 1].data() + bj));
+                __m128i r2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(A[bi + 2].data() + bj));
+                __m128i r3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(A[bi + 3].data() + bj));
+                transpose4x4(r0, r1, r2, r3);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(B[bj].data() + bi), r0);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(B[bj + 1].data() + bi), r1);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(B[bj + 2].data() + bi), r2);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(B[bj + 3].data() + bi), r3);
+            }
+        }
+    });
+    for (size_t i = aligned; i < n; i++)
+        for (size_t j = 0; j < n; j++)
+            B[j][i] = A[i][j];
+    for (size_t i = 0; i < aligned; i++)
+        for (size_t j = aligned; j < n; j++)
+            B[j][i] = A[i][j];
+#else
+    blockTransposeMatrix(A, B, n, tile);
+#endif
+}
+
+using SmallKernel = void (*)(const vector<vector<int>>&, vector<vector<int>>&);
+
+template<size_t... Sizes>
+constexpr array<SmallKernel, sizeof...(Sizes)> smallKernelTable(index_sequence<Sizes...>) {
+    return { &smallTransposeFixed<Sizes + 1>... };
+}
+
+const size_t maxSmallSize = 64;
+
+// Sends n <= 64 to the kernel compiled for exactly that n; returns false for larger matrices.
+bool smallTransposeMatrix(const vector<vector<int>>& A, vector<vector<int>>& B, size_t n) {
+    static constexpr auto kernels = smallKernelTable(make_index_sequence<maxSmallSize>());
+    if (n == 0 || n > maxSmallSize)
+        return n == 0;
+    kernels[n - 1](A, B);
+    return true;
+}
+
+// Converts pixels [pBegin, pEnd) of one image. For C=3 the SIMD path stores 4 lanes per pixel
+// and relies on the next pixel overwriting the spare lane, so it stops 4 pixels before pEnd.
+void nchwToNhwcPixels(const int* src, int* dst, size_t channels, size_t hw, size_t pBegin, size_t pEnd) {
+    size_t p = pBegin;
+#ifdef HAS_SSE2
+    if (channels == 2) {
+        for (; p + 4 <= pEnd; p += 4) {
+            __m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + p));
+            __m128i r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + hw + p));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2 * p), _mm_unpacklo_epi32(r0, r1));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2 * p + 4), _mm_unpackhi_epi32(r0, r1));
+        }
+    } else if (channels == 3) {
+        const __m128i zero = _mm_setzero_si128();
+        for (; p + 4 < pEnd; p += 4) {
+            __m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + p));
+            __m128i r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + hw + p));
+            __m128i r2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * hw + p));
+            __m128i r3 = zero;
+            transpose4x4(r0, r1, r2, r3);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3 * p), r0);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3 * p + 3), r1);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3 * p + 6), r2);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3 * p + 9), r3);
+        }
+    } else if (channels % 4 == 0) {
+        for (; p + 4 <= pEnd; p += 4) {
+            for (size_t c = 0; c < channels; c += 4) {
+                __m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + c * hw + p));
+                __m128i r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + (c + 1) * hw + p));
+                __m128i r2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + (c + 2) * hw + p));
+                __m128i r3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + (c + 3) * hw + p));
+                transpose4x4(r0, r1, r2, r3);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + p * channels + c), r0);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + (p + 1) * channels + c), r1);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + (p + 2) * channels + c), r2);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + (p + 3) * channels + c), r3);
+            }
+        }
+    }
+#endif
+    for (; p < pEnd; p++)
+        for (size_t c = 0; c < channels; c++)
+            dst[p * channels + c] = src[c * hw + p];
+}
+
+void nhwcToNchwPixels(const int* src, int* dst, size_t channels, size_t hw, size_t pBegin, size_t pEnd) {
+    size_t p = pBegin;
+#ifdef HAS_SSE2
+    if (channels == 2) {
+        for (; p + 4 <= pEnd; p += 4) {
+            __m128i r0 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * p)), _MM_SHUFFLE(3, 1, 2, 0));
+            __m128i r1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * p + 4)), _MM_SHUFFLE(3, 1, 2, 0));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + p), _mm_unpacklo_epi64(r0, r1));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + hw + p), _mm_unpackhi_epi64(r0, r1));
+        }
+    } else if (channels == 3) {
+        for (; p + 4 < pEnd; p += 4) {
+            __m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 3 * p));
+            __m128i r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 3 * p + 3));
+            __m128i r2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 3 * p + 6));
+            __m128i r3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 3 * p + 9));
+            transpose4x4(r0, r1, r2, r3);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + p), r0);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + hw + p), r1);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2 * hw + p), r2);
+        }
+    } else if (channels % 4 == 0) {
+        for (; p + 4 <= pEnd; p += 4) {
+            for (size_t c = 0; c < channels; c += 4) {
+                __m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + p * channels + c));
+                __m128i r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + (p + 1) * channels + c));
+                __m128i r2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + (p + 2) * channels + c));
+                __m128i r3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + (p + 3) * channels + c));
+                transpose4x4(r0, r1, r2, r3);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + c * hw + p), r0);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + (c + 1) * hw + p), r1);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + (c + 2) * hw + p), r2);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + (c + 3) * hw + p), r3);
+            }
+        }
+    }
+#endif
+    for (; p < pEnd; p++)
+        for (size_t c = 0; c < channels; c++)
+            dst[c * hw + p] = src[p * channels + c];
+}
+
+enum class LayoutDirection { NchwToNhwc, NhwcToNchw };
+
+void convertLayout(const int* src, int* dst, size_t batch, size_t channels, size_t hw,
+                   LayoutDirection direction, unsigned threadCount) {
+    const size_t chunkPixels = 16384;
+    size_t chunks = (hw + chunkPixels - 1) / chunkPixels;
+    parallelFor(batch * chunks, threadCount, [&](size_t item) {
+        size_t image = item / chunks;
+        size_t pBegin = (item % chunks) * chunkPixels;
+        size_t pEnd = min(pBegin + chunkPixels, hw);
+        size_t offset = image * channels * hw;
+        if (direction == LayoutDirection::NchwToNhwc)
+            nchwToNhwcPixels(src + offset, dst + offset, channels, hw, pBegin, pEnd);
+        else
+            nhwcToNchwPixels(src + offset, dst + offset, channels, hw, pBegin, pEnd);
+    });
+}
+
+bool runLayoutBenchmark(size_t batchOverride, unsigned threadCount, size_t blockSize) {
+    struct LayoutCase { const char* name; size_t height, width, channels, batch; };
+    const LayoutCase cases[] = {
+        { "224x224x3",   224,  224,  3, 8 },
+        { "224x224x4",   224,  224,  4, 8 },
+        { "224x224x16",  224,  224, 16, 8 },
+        { "1920x1080x3", 1080, 1920, 3, 1 },
+        { "1920x1080x4", 1080, 1920, 4, 1 },
+    };
+    // Each case holds src, expected and dst at once and frees them before the next.
+    size_t requiredBytes = 0;
+    for (const auto& layout : cases) {
+        size_t batch = batchOverride > 0 ? batchOverride : layout.batch;
+        requiredBytes = max(requiredBytes, 3 * batch * layout.channels * layout.height * layout.width * sizeof(int));
+    }
+    if (!fitsMemoryLimit(requiredBytes, "--layout"))
+        return false;
+
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    cout << " " << setw(18) << left << "Image (HxWxC)"
+         << setw(20) << "Direction"
+         << setw(20) << "Batch"
+         << setw(20) << "Permute Time (ns)"
+         << setw(20) << "Kernel Time (ns)"
+         << setw(20) << "Ratio (Perm/Kern)"
+         << setw(20) << "Correct" << endl;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    for (const auto& layout : cases) {
+        size_t batch = batchOverride > 0 ? batchOverride : layout.batch;
+        size_t hw = layout.height * layout.width;
+        size_t total = batch * layout.channels * hw;
+        vector<int> src(total), expected(total), dst(total);
+        for (size_t i = 0; i < total; i++)
+            src[i] = static_cast<int>(i);
+
+        for (auto direction : { LayoutDirection::NchwToNhwc, LayoutDirection::NhwcToNchw }) {
+            bool toNhwc = direction == LayoutDirection::NchwToNhwc;
+            vector<size_t> shape = toNhwc ? vector<size_t>{ batch, layout.channels, layout.height, layout.width }
+                                          : vector<size_t>{ batch, layout.height, layout.width, layout.channels };
+            vector<int> perm = toNhwc ? vector<int>{ 0, 2, 3, 1 } : vector<int>{ 0, 3, 1, 2 };
+
+            auto timer = zen::timer();
+            timer.start();
+            permuteTensor(src.data(), expected.data(), shape, perm, blockSize);
+            timer.stop();
+            double permuteTime = timer.duration<zen::timer::nsec>().count();
+
+            timer.start();
+            convertLayout(src.data(), dst.data(), batch, layout.channels, hw, direction, threadCount);
+            timer.stop();
+            double kernelTime = timer.duration<zen::timer::nsec>().count();
+
+            cout << " " << setw(18) << left << layout.name
+                 << setw(20) << (toNhwc ? "NCHW->NHWC" : "NHWC->NCHW")
+                 << setw(20) << batch
+                 << setw(20) << fixed << setprecision(2) << (permuteTime / 1000.0)
+                 << setw(20) << fixed << setprecision(2) << (kernelTime / 1000.0)
+                 << setw(20) << fixed << setprecision(2) << (permuteTime / kernelTime)
+                 << setw(20) << (dst == expected ? "yes" : "NO") << endl;
+        }
+    }
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    return true;
+}
+
+template<size_t Width>
+void narrowRowsToColumns(const int* src, int* dst, size_t rows, size_t rBegin, size_t rEnd) {
+    for (size_t r = rBegin; r < rEnd; r++)
+        for (size_t c = 0; c < Width; c++)
+            dst[c * rows + r] = src[r * Width + c];
+}
+
+template<size_t Width>
+void columnsToNarrowRows(const int* src, int* dst, size_t rows, size_t rBegin, size_t rEnd) {
+    for (size_t r = rBegin; r < rEnd; r++)
+        for (size_t c = 0; c < Width; c++)
+            dst[r * Width + c] = src[c * rows + r];
+}
+
+using NarrowKernel = void (*)(const int*, int*, size_t, size_t, size_t);
+
+template<size_t... Widths>
+constexpr array<NarrowKernel, sizeof...(Widths)> narrowKernelTable(bool toColumns, index_sequence<Widths...>) {
+    return toColumns ? array<NarrowKernel, sizeof...(Widths)>{ &narrowRowsToColumns<Widths + 1>... }
+                     : array<NarrowKernel, sizeof...(Widths)>{ &columnsToNarrowRows<Widths + 1>... };
+}
+
+const size_t maxNarrowWidth = 16;
+
+// Transposes a (rows x width) matrix with width <= 16 into (width x rows), or back, keeping one
+// write stream per column. Widths with an SSE2 path (2, 3, multiples of 4) use the layout kernels;
+// the rest use a scalar kernel instantiated for that width, whose inner loop bound is a compile-time
+// constant (how far it unrolls is left to the compiler). Returns false for widths outside [1, 16].
+bool narrowTranspose(const int* src, int* dst, size_t rows, size_t width, bool toColumns, unsigned threadCount) {
+    if (width == 0 || width > maxNarrowWidth) {
+        cerr << "narrowTranspose: width " << width << " is outside [1, " << maxNarrowWidth << "]" << endl;
+        return false;
+    }
+    static const auto toColumnKernels = narrowKernelTable(true, make_index_sequence<maxNarrowWidth>());
+    static const auto toRowKernels = narrowKernelTable(false, make_index_sequence<maxNarrowWidth>());
+    bool simd = false;
+#ifdef HAS_SSE2
+    simd = width == 2 || width == 3 || width % 4 == 0;
+#endif
+    if (simd) {
+        convertLayout(src, dst, 1, width, rows, toColumns ? LayoutDirection::NhwcToNchw : LayoutDirection::NchwToNhwc, threadCount);
+        return true;
+    }
+    NarrowKernel kernel = (toColumns ? toColumnKernels : toRowKernels)[width - 1];
+    const size_t chunkRows = 16384;
+    size_t chunks = (rows + chunkRows - 1) / chunkRows;
+    parallelFor(chunks, threadCount, [&](size_t chunk) {
+        kernel(src, dst, rows, chunk * chunkRows, min((chunk + 1) * chunkRows, rows));
+    });
+    return true;
+}
+
+// Transposes a (rows x cols) row-major matrix into (cols x rows), picking the narrow kernels when
+// one side is at most 16 wide and the matrix is at least 8 times longer than it is wide.
+void transposeRectangular(const int* src, int* dst, size_t rows, size_t cols, size_t blockSize, unsigned threadCount) {
+    const size_t minAspectRatio = 8;
+    if (rows == 0 || cols == 0)
+        return;
+    if (cols <= maxNarrowWidth && rows >= minAspectRatio * cols)
+        narrowTranspose(src, dst, rows, cols, true, threadCount);
+    else if (rows <= maxNarrowWidth && cols >= minAspectRatio * rows)
+        narrowTranspose(src, dst, cols, rows, false, threadCount);
+    else
+        blockTransposeStrided(src, cols, dst, rows, rows, cols, blockSize);
+}
+
+void runNarrowBenchmark(size_t longSide, unsigned threadCount, size_t blockSize) {
+    struct ShapeCase { size_t rows, cols; };
+    const ShapeCase cases[] = {
+        { longSide, 1 }, { longSide, 3 }, { longSide, 4 }, { longSide, 7 },
+        { longSide, 10 }, { longSide, 16 }, { 4, longSide }, { 13, longSide },
+    };
+
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    cout << " " << setw(18) << left << "Shape (R x C)"
+         << setw(20) << "Naive Time (ns)"
+         << setw(20) << "Block Time (ns)"
+         << setw(20) << "Narrow Time (ns)"
+         << setw(20) << "Ratio (Block/Narr)"
+         << setw(20) << "Throughput (GB/s)"
+         << setw(20) << "Correct" << endl;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    for (const auto& shape : cases) {
+        size_t total = shape.rows * shape.cols;
+        vector<int> src(total), expected(total), blocked(total), dst(total);
+        for (size_t i = 0; i < total; i++)
+            src[i] = static_cast<int>(i);
+
+        auto timer = zen::timer();
+        timer.start();
+        for (size_t r = 0; r < shape.rows; r++)
+            for (size_t c = 0; c < shape.cols; c++)
+                expected[c * shape.rows + r] = src[r * shape.cols + c];
+        timer.stop();
+        double naiveTime = timer.duration<zen::timer::nsec>().count();
+
+        timer.start();
+        blockTransposeStrided(src.data(), shape.cols, blocked.data(), shape.rows, shape.rows, shape.cols, blockSize);
+        timer.stop();
+        double blockTime = timer.duration<zen::timer::nsec>().count();
+
+        timer.start();
+        transposeRectangular(src.data(), dst.data(), shape.rows, shape.cols, blockSize, threadCount);
+        timer.stop();
+        double narrowTime = timer.duration<zen::timer::nsec>().count();
+
+        cout << " " << setw(18) << left << (to_string(shape.rows) + "x" + to_string(shape.cols))
+             << setw(20) << fixed << setprecision(2) << (naiveTime / 1000.0)
+             << setw(20) << fixed << setprecision(2) << (blockTime / 1000.0)
+             << setw(20) << fixed << setprecision(2) << (narrowTime / 1000.0)
+             << setw(20) << fixed << setprecision(2) << (blockTime / narrowTime)
+             << setw(20) << fixed << setprecision(2) << (2.0 * total * sizeof(int) / narrowTime)
+             << setw(20) << (dst == expected && blocked == expected ? "yes" : "NO") << endl;
+    }
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+}
+
+// Records of `stride` bytes whose fields are packed back to back starting at offset 0.
+// The SoA side stores field f as one column of count * widths[f] bytes, columns back to back.
+struct RecordLayout {
+    size_t stride;
+    vector<size_t> widths;
+
+    // Fields are packed from offset 0, so the record must be at least as wide as their sum.
+    RecordLayout(size_t recordStride, vector<size_t> fieldWidths) : stride(recordStride), widths(move(fieldWidths)) {
+        if (widths.empty() || any_of(widths.begin(), widths.end(), [](size_t w) { return w == 0; }))
+            throw invalid_argument("RecordLayout needs at least one field and no zero-width fields");
+        if (stride < packedSize())
+            throw invalid_argument("RecordLayout stride " + to_string(stride) + " is smaller than its "
+                                   + to_string(packedSize()) + " bytes of fields");
+    }
+
+    size_t fieldOffset(size_t field) const {
+        size_t offset = 0;
+        for (size_t f = 0; f < field; f++)
+            offset += widths[f];
+        return offset;
+    }
+    size_t packedSize() const { return fieldOffset(widths.size()); }
+    bool isUniformInt() const {
+        return all_of(widths.begin(), widths.end(), [](size_t w) { return w == sizeof(int); })
+            && stride == widths.size() * sizeof(int);
+    }
+};
+
+inline void copyField(unsigned char* dst, const unsigned char* src, size_t width) {
+    switch (width) {
+    case 1: *dst = *src; break;
+    case 2: memcpy(dst, src, 2); break;
+    case 4: memcpy(dst, src, 4); break;
+    case 8: memcpy(dst, src, 8); break;
+    default: memcpy(dst, src, width); break;
+    }
+}
+
+template<size_t Width>
+void copyFieldRun(unsigned char* dst, size_t dstStride, const unsigned char* src, size_t srcStride, size_t n) {
+    for (size_t r = 0; r < n; r++)
+        memcpy(dst + r * dstStride, src + r * srcStride, Width);
+}
+
+void copyFieldRun(unsigned char* dst, size_t dstStride, const unsigned char* src, size_t srcStride, size_t n, size_t width) {
+    switch (width) {
+    case 1: copyFieldRun<1>(dst, dstStride, src, srcStride, n); break;
+    case 2: copyFieldRun<2>(dst, dstStride, src, srcStride, n); break;
+    case 4: copyFieldRun<4>(dst, dstStride, src, srcStride, n); break;
+    case 8: copyFieldRun<8>(dst, dstStride, src, srcStride, n); break;
+    default:
+        for (size_t r = 0; r < n; r++)
+            memcpy(dst + r * dstStride, src + r * srcStride, width);
+    }
+}
+
+void naiveAosToSoa(const unsigned char* aos, unsigned char* soa, size_t count, const RecordLayout& layout) {
+    for (size_t r = 0; r < count; r++) {
+        size_t offset = 0;
+        for (size_t f = 0; f < layout.widths.size(); f++) {
+            copyField(soa + count * offset + r * layout.widths[f], aos + r * layout.stride + offset, layout.widths[f]);
+            offset += layout.widths[f];
+        }
+    }
+}
+
+void naiveSoaToAos(const unsigned char* soa, unsigned char* aos, size_t count, const RecordLayout& layout) {
+    for (size_t r = 0; r < count; r++) {
+        size_t offset = 0;
+        for (size_t f = 0; f < layout.widths.size(); f++) {
+            copyField(aos + r * layout.stride + offset, soa + count * offset + r * layout.widths[f], layout.widths[f]);
+            offset += layout.widths[f];
+        }
+    }
+}
+
+// Uniform 4-byte fields are exactly an (N x K) int transpose and reuse the layout kernels
+// (SIMD for K = 2, 3, 4, 8). The bytes are never read through an int pointer: each record tile is
+// memcpy'd into an int staging tile, transposed there and memcpy'd out. Other layouts copy one
+// field column at a time within a record tile.
+void convertRecords(const unsigned char* src, unsigned char* dst, size_t count, const RecordLayout& layout,
+                    bool toSoa, unsigned threadCount) {
+    const size_t chunkRecords = 16384;
+    const size_t tileRecords = 256;
+    size_t fields = layout.widths.size();
+    vector<size_t> offsets(fields);
+    for (size_t f = 0; f < fields; f++)
+        offsets[f] = layout.fieldOffset(f);
+    bool uniformInt = layout.isUniformInt();
+
+    size_t chunks = (count + chunkRecords - 1) / chunkRecords;
+    parallelFor(chunks, count >= 4 * chunkRecords ? threadCount : 1, [&](size_t chunk) {
+        size_t rBegin = chunk * chunkRecords;
+        size_t rEnd = min(rBegin + chunkRecords, count);
+        if (uniformInt) {
+            vector<int> records(tileRecords * fields), columns(tileRecords * fields);
+            for (size_t t = rBegin; t < rEnd; t += tileRecords) {
+                size_t tCount = min(t + tileRecords, rEnd) - t;
+                if (toSoa) {
+                    memcpy(records.data(), src + t * layout.stride, tCount * layout.stride);
+                    nhwcToNchwPixels(records.data(), columns.data(), fields, tCount, 0, tCount);
+                    for (size_t f = 0; f < fields; f++)
+                        memcpy(dst + count * offsets[f] + t * sizeof(int), columns.data() + f * tCount, tCount * sizeof(int));
+                } else {
+                    for (size_t f = 0; f < fields; f++)
+                        memcpy(columns.data() + f * tCount, src + count * offsets[f] + t * sizeof(int), tCount * sizeof(int));
+                    nchwToNhwcPixels(columns.data(), records.data(), fields, tCount, 0, tCount);
+                    memcpy(dst + t * layout.stride, records.data(), tCount * layout.stride);
+                }
+            }
+            return;
+        }
+        for (size_t t = rBegin; t < rEnd; t += tileRecords) {
+            size_t tEnd = min(t + tileRecords, rEnd);
+            for (size_t f = 0; f < fields; f++) {
+                size_t width = layout.widths[f];
+                size_t columnStart = count * offsets[f] + t * width;
+                size_t recordStart = t * layout.stride + offsets[f];
+                if (toSoa)
+                    copyFieldRun(dst + columnStart, width, src + recordStart, layout.stride, tEnd - t, width);
+                else
+                    copyFieldRun(dst + recordStart, layout.stride, src + columnStart, width, tEnd - t, width);
+            }
+        }
+    });
+}
+
+void aosToSoa(const unsigned char* aos, unsigned char* soa, size_t count, const RecordLayout& layout, unsigned threadCount) {
+    convertRecords(aos, soa, count, layout, true, threadCount);
+}
+
+void soaToAos(const unsigned char* soa, unsigned char* aos, size_t count, const RecordLayout& layout, unsigned threadCount) {
+    convertRecords(soa, aos, count, layout, false, threadCount);
+}
+
+bool runAosSoaBenchmark(size_t count, unsigned threadCount) {
+    struct RecordCase { const char* name; RecordLayout layout; };
+    const RecordCase cases[] = {
+        { "2 x int32",       { 8,  { 4, 4 } } },
+        { "3 x int32",       { 12, { 4, 4, 4 } } },
+        { "4 x int32",       { 16, { 4, 4, 4, 4 } } },
+        { "8 x int32",       { 32, { 4, 4, 4, 4, 4, 4, 4, 4 } } },
+        { "8,4,2,1,1",       { 16, { 8, 4, 2, 1, 1 } } },
+        { "8,8,4 (pad 24)",  { 24, { 8, 8, 4 } } },
+    };
+    // Per case: three AoS buffers (input, naive and kernel round trip) and two SoA buffers.
+    size_t requiredBytes = 0;
+    for (const auto& record : cases)
+        requiredBytes = max(requiredBytes, count * (3 * record.layout.stride + 2 * record.layout.packedSize()));
+    if (!fitsMemoryLimit(requiredBytes, "--aos"))
+        return false;
+
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    cout << " " << setw(18) << left << "Fields"
+         << setw(20) << "Direction"
+         << setw(20) << "Records"
+         << setw(20) << "Naive Time (ns)"
+         << setw(20) << "Kernel Time (ns)"
+         << setw(20) << "Ratio (Naive/Kern)"
+         << setw(20) << "Correct" << endl;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    for (const auto& record : cases) {
+        const RecordLayout& layout = record.layout;
+        vector<unsigned char> aos(count * layout.stride, 0);
+        for (size_t r = 0; r < count; r++)
+            for (size_t b = 0; b < layout.packedSize(); b++)
+                aos[r * layout.stride + b] = static_cast<unsigned char>(r * 31 + b);
+        vector<unsigned char> soaNaive(count * layout.packedSize()), soa(count * layout.packedSize());
+        vector<unsigned char> aosNaive(aos.size(), 0), aosBack(aos.size(), 0);
+
+        for (bool toSoa : { true, false }) {
+            auto timer = zen::timer();
+            timer.start();
+            if (toSoa)
+                naiveAosToSoa(aos.data(), soaNaive.data(), count, layout);
+            else
+                naiveSoaToAos(soaNaive.data(), aosNaive.data(), count, layout);
+            timer.stop();
+            double naiveTime = timer.duration<zen::timer::nsec>().count();
+
+            timer.start();
+            if (toSoa)
+                aosToSoa(aos.data(), soa.data(), count, layout, threadCount);
+            else
+                soaToAos(soaNaive.data(), aosBack.data(), count, layout, threadCount);
+            timer.stop();
+            double kernelTime = timer.duration<zen::timer::nsec>().count();
+
+            bool correct = toSoa ? soa == soaNaive : (aosBack == aosNaive && aosBack == aos);
+            cout << " " << setw(18) << left << record.name
+                 << setw(20) << (toSoa ? "AoS->SoA" : "SoA->AoS")
+                 << setw(20) << count
+                 << setw(20) << fixed << setprecision(2) << (naiveTime / 1000.0)
+                 << setw(20) << fixed << setprecision(2) << (kernelTime / 1000.0)
+                 << setw(20) << fixed << setprecision(2) << (naiveTime / kernelTime)
+                 << setw(20) << (correct ? "yes" : "NO") << endl;
+        }
+    }
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    return true;
+}
+
+// Counts user-space L1D read misses (i.e. L2 requests), LLC read misses and dTLB read misses
+// via perf_event_open. Counters the kernel or the VM does not expose stay unavailable.
+class CacheCounters {
+public:
+    enum Event { L1DMiss, LLCMiss, DTLBMiss, EventCount };
+
+    CacheCounters() {
+        fds_.fill(-1);
+#ifdef __linux__
+        const uint64_t configs[EventCount] = {
+            PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+            PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+            PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        };
+        for (int e = 0; e < EventCount; e++) {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = configs[e];
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fds_[e] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+#endif
+    }
+
+    ~CacheCounters() {
+#ifdef __linux__
+        for (int fd : fds_)
+            if (fd >= 0) close(fd);
+#endif
+    }
+
+    CacheCounters(const CacheCounters&) = delete;
+    CacheCounters& operator=(const CacheCounters&) = delete;
+
+    void start() {
+#ifdef __linux__
+        for (int fd : fds_) {
+            if (fd < 0) continue;
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    void stop() {
+#ifdef __linux__
+        for (int e = 0; e < EventCount; e++) {
+            values_[e] = -1;
+            if (fds_[e] < 0) continue;
+            ioctl(fds_[e], PERF_EVENT_IOC_DISABLE, 0);
+            long long count = 0;
+            if (read(fds_[e], &count, sizeof(count)) == sizeof(count))
+                values_[e] = count;
+        }
+#endif
+    }
+
+    bool available(Event e) const { return fds_[e] >= 0; }
+    long long value(Event e) const { return values_[e]; }
+
+    string format(Event e) const {
+        return values_[e] >= 0 ? to_string(values_[e]) : string("n/a");
+    }
+
+private:
+    array<int, EventCount> fds_;
+    array<long long, EventCount> values_ = { -1, -1, -1 };
+};
+
+// Core and reference cycles of the calling thread from perf's cpu-cycles and ref-cycles events,
+// the portable stand-ins for the APERF and MPERF MSRs. core / ref * TSC rate is the effective
+// frequency while running; halted time counts in neither.
+class CycleCounters {
+public:
+    CycleCounters() {
+#ifdef __linux__
+        const uint64_t configs[2] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_REF_CPU_CYCLES };
+        for (int e = 0; e < 2; e++) {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[e];
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fds_[e] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+#endif
+    }
+
+    ~CycleCounters() {
+#ifdef __linux__
+        for (int fd : fds_)
+            if (fd >= 0) close(fd);
+#endif
+    }
+
+    CycleCounters(const CycleCounters&) = delete;
+    CycleCounters& operator=(const CycleCounters&) = delete;
+
+    bool available() const { return fds_[0] >= 0; }
+
+    void start() {
+#ifdef __linux__
+        for (int fd : fds_) {
+            if (fd < 0) continue;
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    void stop() {
+#ifdef __linux__
+        for (int e = 0; e < 2; e++) {
+            values_[e] = -1;
+            if (fds_[e] < 0) continue;
+            ioctl(fds_[e], PERF_EVENT_IOC_DISABLE, 0);
+            long long count = 0;
+            if (read(fds_[e], &count, sizeof(count)) == sizeof(count))
+                values_[e] = count;
+        }
+#endif
+    }
+
+    long long coreCycles() const { return values_[0]; }
+    long long refCycles() const { return values_[1]; }
+
+private:
+    array<int, 2> fds_ = { -1, -1 };
+    array<long long, 2> values_ = { -1, -1 };
+};
+
+void runTileOrderBenchmark(size_t n, size_t blockSize, const vector<TileOrder>& orders) {
+    vector<vector<int>> A = makeIndexMatrix(n);
+    vector<vector<int>> expected(n, vector<int>(n, 0));
+    naiveTransposeMatrix(A, expected, n);
+
+    CacheCounters counters;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    cout << " " << setw(18) << left << "Tile Order"
+         << setw(20) << "Matrix Size (n)"
+         << setw(20) << "Block Time (ns)"
+         << setw(20) << "L1D Misses"
+         << setw(20) << "LLC Misses"
+         << setw(20) << "dTLB Misses"
+         << setw(20) << "Correct" << endl;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    for (auto order : orders) {
+        vector<vector<int>> B(n, vector<int>(n, 0));
+        blockTransposeMatrix(A, B, n, blockSize, order);
+
+        auto timer = zen::timer();
+        counters.start();
+        timer.start();
+        blockTransposeMatrix(A, B, n, blockSize, order);
+        timer.stop();
+        counters.stop();
+        double blockTime = timer.duration<zen::timer::nsec>().count();
+
+        cout << " " << setw(18) << left << tileOrderName(order)
+             << setw(20) << n
+             << setw(20) << fixed << setprecision(2) << (blockTime / 1000.0)
+             << setw(20) << counters.format(CacheCounters::L1DMiss)
+             << setw(20) << counters.format(CacheCounters::LLCMiss)
+             << setw(20) << counters.format(CacheCounters::DTLBMiss)
+             << setw(20) << (B == expected ? "yes" : "NO") << endl;
+    }
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+}
+
+// Times every bh x bw pair from a grid of power-of-two multiples of a cache line on the actual
+// matrices and returns the fastest, together with the fastest square tile for comparison.
+TileShape tuneTileShape(const vector<vector<int>>& A, vector<vector<int>>& B, size_t n, int cacheLineSize, TileShape* bestSquare = nullptr) {
+    size_t elementsPerCacheLine = cacheLineSize / sizeof(int);
+    vector<size_t> sides;
+    for (size_t side = max<size_t>(elementsPerCacheLine / 4, 1); side <= min<size_t>(n, 512); side *= 2)
+        sides.push_back(side);
+    if (sides.empty())
+        sides.push_back(max<size_t>(n, 1));
+
+    TileShape best = { sides[0], sides[0] };
+    double bestTime = numeric_limits<double>::max(), bestSquareTime = numeric_limits<double>::max();
+    for (size_t bh : sides) {
+        for (size_t bw : sides) {
+            TileShape candidate = { bh, bw };
+            double fastest = zen::measure_statistics(3, [&] { blockTransposeMatrix(A, B, n, candidate); }).min();
+            if (fastest < bestTime) {
+                bestTime = fastest;
+                best = candidate;
+            }
+            if (bh == bw && bestSquare && fastest < bestSquareTime) {
+                bestSquareTime = fastest;
+                *bestSquare = candidate;
+            }
+        }
+    }
+    return best;
+}
+
+void runTileShapeBenchmark(size_t n, int l1CacheSizeKB, int associativity, int cacheLineSize, size_t blockSize) {
+    vector<vector<int>> A = makeIndexMatrix(n);
+    vector<vector<int>> B(n, vector<int>(n, 0));
+    vector<vector<int>> expected(n, vector<int>(n, 0));
+    naiveTransposeMatrix(A, expected, n);
+
+    TileShape tunedSquare = { blockSize, blockSize };
+    TileShape tuned = tuneTileShape(A, B, n, cacheLineSize, &tunedSquare);
+    struct TilingCase { const char* name; TileShape tile; };
+    const TilingCase cases[] = {
+        { "square (model)", { blockSize, blockSize } },
+        { "rect (model)",   calculateOptimalTileShape(l1CacheSizeKB, associativity, cacheLineSize, n) },
+        { "square (tuned)", tunedSquare },
+        { "rect (tuned)",   tuned },
+    };
+
+    double squareTime = 0;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    cout << " " << setw(18) << left << "Tiling"
+         << setw(20) << "Matrix Size (n)"
+         << setw(20) << "Tile (bh x bw)"
+         << setw(20) << "Block Time (ns)"
+         << setw(20) << "Ratio (Square/This)"
+         << setw(20) << "Correct" << endl;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    for (const auto& tiling : cases) {
+        double fastest = zen::measure_statistics(3, [&] { blockTransposeMatrix(A, B, n, tiling.tile); }).min();
+        if (squareTime == 0)
+            squareTime = fastest;
+        cout << " " << setw(18) << left << tiling.name
+             << setw(20) << n
+             << setw(20) << (to_string(tiling.tile.rows) + " x " + to_string(tiling.tile.cols))
+             << setw(20) << fixed << setprecision(2) << (fastest / 1000.0)
+             << setw(20) << fixed << setprecision(2) << (squareTime / fastest)
+             << setw(20) << (B == expected ? "yes" : "NO") << endl;
+    }
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+}
+
+// Side of the outer (page-level) block: a P x P block of A plus the matching block of B must map
+// to no more than half of the second-level TLB. Returns n when rows share pages anyway.
+size_t calculateTlbBlockSize(size_t stlbEntries, size_t pageSize, size_t n, size_t blockSize) {
+    if (n * sizeof(int) <= pageSize)
+        return n;
+    size_t outer = blockSize;
+    while (outer + blockSize <= n) {
+        size_t candidate = outer + blockSize;
+        size_t pagesPerRowRun = (candidate * sizeof(int) + pageSize - 1) / pageSize + 1;
+        if (2 * candidate * pagesPerRowRun > stlbEntries / 2) break;
+        outer = candidate;
+    }
+    return outer;
+}
+
+void tlbBlockTransposeMatrix(const vector<vector<int>>& A, vector<vector<int>>& B, size_t n, size_t outerBlockSize, size_t blockSize) {
+    for (size_t oi = 0; oi < n; oi += outerBlockSize) {
+        size_t oiEnd = min(oi + outerBlockSize, n);
+        for (size_t oj = 0; oj < n; oj += outerBlockSize) {
+            size_t ojEnd = min(oj + outerBlockSize, n);
+            for (size_t i = oi; i < oiEnd; i += blockSize) {
+                for (size_t j = oj; j < ojEnd; j += blockSize) {
+                    for (size_t bi = i; bi < i + blockSize && bi < oiEnd; bi++) {
+                        for (size_t bj = j; bj < j + blockSize && bj < ojEnd; bj++) {
+                            B[bj][bi] = A[bi][bj];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void runTlbBenchmark(size_t n, size_t blockSize) {
+    int dtlbEntries, stlbEntries;
+    getTlbParameters(dtlbEntries, stlbEntries);
+    size_t outerBlockSize = calculateTlbBlockSize(stlbEntries, 4096, n, blockSize);
+    cout << "dTLB entries (4K): " << dtlbEntries << ", STLB entries (4K): " << stlbEntries
+         << ", outer block: " << outerBlockSize << endl;
+
+    vector<vector<int>> A = makeIndexMatrix(n);
+    vector<vector<int>> expected(n, vector<int>(n, 0));
+    vector<vector<int>> B(n, vector<int>(n, 0));
+    naiveTransposeMatrix(A, expected, n);
+
+    CacheCounters counters;
+    double blockTime = 0;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    cout << " " << setw(18) << left << "Kernel"
+         << setw(20) << "Matrix Size (n)"
+         << setw(20) << "Outer x Tile"
+         << setw(20) << "Time (ns)"
+         << setw(20) << "dTLB Misses"
+         << setw(20) << "Ratio (Block/This)"
+         << setw(20) << "Correct" << endl;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    for (bool tlbAware : { false, true }) {
+        auto run = [&]() {
+            if (tlbAware)
+                tlbBlockTransposeMatrix(A, B, n, outerBlockSize, blockSize);
+            else
+                blockTransposeMatrix(A, B, n, blockSize);
+        };
+        run();
+        auto timer = zen::timer();
+        counters.start();
+        timer.start();
+        run();
+        timer.stop();
+        counters.stop();
+        double time = timer.duration<zen::timer::nsec>().count();
+        if (!tlbAware)
+            blockTime = time;
+        cout << " " << setw(18) << left << (tlbAware ? "tlb + block" : "block")
+             << setw(20) << n
+             << setw(20) << ((tlbAware ? to_string(outerBlockSize) : string("-")) + " x " + to_string(blockSize))
+             << setw(20) << fixed << setprecision(2) << (time / 1000.0)
+             << setw(20) << counters.format(CacheCounters::DTLBMiss)
+             << setw(20) << fixed << setprecision(2) << (blockTime / time)
+             << setw(20) << (B == expected ? "yes" : "NO") << endl;
+    }
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+}
+
+void runBounceBenchmark(const vector<size_t>& sizes, size_t blockSize) {
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    cout << " " << setw(18) << left << "Tile Write"
+         << setw(20) << "Matrix Size (n)"
+         << setw(20) << "Block Size"
+         << setw(20) << "Block Time (ns)"
+         << setw(20) << "L1D Misses"
+         << setw(20) << "Ratio (Direct/This)"
+         << setw(20) << "Correct" << endl;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    CacheCounters counters;
+    for (size_t n : sizes) {
+        vector<vector<int>> A = makeIndexMatrix(n);
+        vector<vector<int>> expected(n, vector<int>(n, 0));
+        naiveTransposeMatrix(A, expected, n);
+
+        double directTime = 0;
+        for (auto write : { TileWrite::Direct, TileWrite::Bounce, TileWrite::BounceNonTemporal }) {
+            vector<vector<int>> B(n, vector<int>(n, 0));
+            blockTransposeMatrix(A, B, n, blockSize, TileOrder::Row, write);
+            auto timer = zen::timer();
+            counters.start();
+            timer.start();
+            blockTransposeMatrix(A, B, n, blockSize, TileOrder::Row, write);
+            timer.stop();
+            counters.stop();
+            double time = timer.duration<zen::timer::nsec>().count();
+            if (write == TileWrite::Direct)
+                directTime = time;
+            cout << " " << setw(18) << left << tileWriteName(write)
+                 << setw(20) << n
+                 << setw(20) << blockSize
+                 << setw(20) << fixed << setprecision(2) << (time / 1000.0)
+                 << setw(20) << counters.format(CacheCounters::L1DMiss)
+                 << setw(20) << fixed << setprecision(2) << (directTime / time)
+                 << setw(20) << (B == expected ? "yes" : "NO") << endl;
+        }
+    }
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+}
+
+bool isTransposeOf(const vector<vector<int>>& A, const vector<vector<int>>& B, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        for (size_t j = 0; j < n; j++)
+            if (B[j][i] != A[i][j]) return false;
+    return true;
+}
+
+// Runs blockTransposeStrided (the kernel under permuteTensor and the skinny fallback) at element
+// offsets past 2^32 on both sides without needing tens of GB: src is 40000 rows with a 2^17-element
+// stride of which only 16 columns are used, dst is the 16 x 40000 result with a 2^29-element
+// stride. Both are sparse anonymous mappings without huge pages, so only the touched pages (about
+// 170 MB) become resident. `ran` is false where such a mapping is unavailable or would not fit.
+bool verifyWideOffsets(size_t blockSize, bool& ran, double& ns) {
+    ran = false;
+    ns = 0;
+#if defined(__linux__)
+    const size_t rows = 40000, cols = 16;
+    const size_t srcStride = size_t(1) << 17, dstStride = size_t(1) << 29;
+    if (sizeof(size_t) < 8 || !fitsMemoryLimit(rows * 4096 + cols * rows * sizeof(int), "--verify (offsets past 2^32)"))
+        return true;
+    size_t srcBytes = ((rows - 1) * srcStride + cols) * sizeof(int);
+    size_t dstBytes = ((cols - 1) * dstStride + rows) * sizeof(int);
+    auto map = [](size_t bytes) -> int* {
+        void* region = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (region == MAP_FAILED)
+            return nullptr;
+        madvise(region, bytes, MADV_NOHUGEPAGE);
+        return static_cast<int*>(region);
+    };
+    int* src = map(srcBytes);
+    int* dst = map(dstBytes);
+    bool correct = true;
+    if (src && dst) {
+        for (size_t r = 0; r < rows; r++)
+            for (size_t c = 0; c < cols; c++)
+                src[r * srcStride + c] = static_cast<int>(r * cols + c);
+        auto timer = zen::timer();
+        timer.start();
+        blockTransposeStrided(src, srcStride, dst, dstStride, rows, cols, blockSize);
+        timer.stop();
+        ns = static_cast<double>(timer.duration<zen::timer::nsec>().count());
+        for (size_t c = 0; c < cols; c++)
+            for (size_t r = 0; r < rows; r++)
+                correct = correct && dst[c * dstStride + r] == static_cast<int>(r * cols + c);
+        ran = true;
+    }
+    if (src) munmap(src, srcBytes);
+    if (dst) munmap(dst, dstBytes);
+    return correct;
+#else
+    (void)blockSize;
+    return true;
+#endif
+}
+
+// Checks every 2D kernel at size n without keeping a reference copy, so the largest sizes
+// (n > 46340, i.e. more than 2^31 elements) only need memory for A and B. A strided transpose
+// at offsets past 2^32 runs at every n.
+bool runVerification(size_t n, size_t blockSize) {
+    vector<vector<int>> A = makeIndexMatrix(n);
+    vector<vector<int>> B(n, vector<int>(n, 0));
+    size_t outerBlockSize = calculateTlbBlockSize(1536, 4096, n, blockSize);
+
+    struct KernelCase { const char* name; function<void()> run; };
+    const KernelCase kernels[] = {
+        { "naive",         [&] { naiveTransposeMatrix(A, B, n); } },
+        { "block",         [&] { blockTransposeMatrix(A, B, n, blockSize); } },
+        { "block hilbert", [&] { blockTransposeMatrix(A, B, n, blockSize, TileOrder::Hilbert); } },
+        { "bounce + nt",   [&] { blockTransposeMatrix(A, B, n, blockSize, TileOrder::Row, TileWrite::BounceNonTemporal); } },
+        { "tlb + block",   [&] { tlbBlockTransposeMatrix(A, B, n, outerBlockSize, blockSize); } },
+        { "recursive",     [&] { recursiveTransposeMatrix(A, B, n); } },
+        { "simd block",    [&] { simdBlockTransposeMatrix(A, B, n, TileShape{ blockSize, blockSize }); } },
+    };
+
+    bool allCorrect = true;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    cout << " " << setw(18) << left << "Kernel"
+         << setw(20) << "Matrix Size (n)"
+         << setw(20) << "Elements"
+         << setw(20) << "Time (ns)"
+         << setw(20) << "Correct" << endl;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    for (const auto& kernel : kernels) {
+        for (auto& row : B)
+            fill(row.begin(), row.end(), 0);
+        auto timer = zen::timer();
+        timer.start();
+        kernel.run();
+        timer.stop();
+        bool correct = isTransposeOf(A, B, n);
+        allCorrect = allCorrect && correct;
+        cout << " " << setw(18) << left << kernel.name
+             << setw(20) << n
+             << setw(20) << n * n
+             << setw(20) << fixed << setprecision(2) << (timer.duration<zen::timer::nsec>().count() / 1000.0)
+             << setw(20) << (correct ? "yes" : "NO") << endl;
+    }
+    bool ran;
+    double wideNs;
+    bool wideCorrect = verifyWideOffsets(blockSize, ran, wideNs);
+    allCorrect = allCorrect && wideCorrect;
+    cout << " " << setw(18) << left << "strided > 2^32"
+         << setw(20) << "40000x16"
+         << setw(20) << 40000 * 16
+         << setw(20) << fixed << setprecision(2) << (wideNs / 1000.0)
+         << setw(20) << (!ran ? "skipped" : wideCorrect ? "yes" : "NO") << endl;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    return allCorrect;
+}
+
+// Locks current and future pages so the timed loop never takes a major or minor fault, and
+// optionally moves the calling thread to SCHED_FIFO so only higher-priority work can preempt it.
+bool enterLatencyMode(bool fifo, int priority) {
+    bool ok = true;
+#ifdef __linux__
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        perror("mlockall failed (raise RLIMIT_MEMLOCK or run with CAP_IPC_LOCK)");
+        ok = false;
+    }
+    if (fifo) {
+        sched_param param{};
+        param.sched_priority = min(max(priority, sched_get_priority_min(SCHED_FIFO)), sched_get_priority_max(SCHED_FIFO));
+        int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (error != 0) {
+            cerr << "Failed to enable SCHED_FIFO: " << strerror(error) << endl;
+            ok = false;
+        }
+    }
+#elif defined(_WIN32)
+    if (fifo && !SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL)) {
+        cerr << "Failed to raise thread priority: " << GetLastError() << endl;
+        ok = false;
+    }
+    (void)priority;
+#else
+    (void)fifo;
+    (void)priority;
+    cerr << "Memory locking is not supported on this platform" << endl;
+    ok = false;
+#endif
+    return ok;
+}
+
+// Writes one element per page so every page is backed before timing starts.
+void prefault(vector<vector<int>>& matrix) {
+    const size_t stride = 4096 / sizeof(int);
+    for (auto& row : matrix) {
+        volatile int* data = row.data();
+        for (size_t k = 0; k < row.size(); k += stride)
+            data[k] = data[k];
+        if (!row.empty())
+            data[row.size() - 1] = data[row.size() - 1];
+    }
+}
+
+// Times every call separately and prints percentiles up to p99.9 plus a log2 latency histogram.
+void runLatencyBenchmark(size_t n, size_t blockSize, size_t iterations) {
+    vector<vector<int>> A = makeIndexMatrix(n);
+    vector<vector<int>> B(n, vector<int>(n, 0));
+    prefault(A);
+    prefault(B);
+    for (int warmup = 0; warmup < 100; warmup++)
+        blockTransposeMatrix(A, B, n, blockSize);
+
+    auto stats = zen::measure_statistics(iterations, [&] { blockTransposeMatrix(A, B, n, blockSize); });
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    cout << " " << setw(18) << left << "Matrix Size (n)"
+         << setw(17) << "Calls"
+         << setw(17) << "Min (ns)"
+         << setw(17) << "p50 (ns)"
+         << setw(17) << "p99 (ns)"
+         << setw(17) << "p99.9 (ns)"
+         << setw(17) << "Max (ns)"
+         << setw(17) << "Correct" << endl;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    cout << " " << setw(18) << left << n << fixed << setprecision(0)
+         << setw(17) << stats.count()
+         << setw(17) << stats.min()
+         << setw(17) << stats.median()
+         << setw(17) << stats.percentile(99)
+         << setw(17) << stats.percentile(99.9)
+         << setw(17) << stats.max()
+         << setw(17) << (isTransposeOf(A, B, n) ? "yes" : "NO") << endl;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+
+    map<int, size_t> buckets;
+    for (double sample : stats.samples())
+        buckets[sample < 1 ? 0 : static_cast<int>(log2(sample))]++;
+    size_t largest = 0;
+    for (const auto& bucket : buckets)
+        largest = max(largest, bucket.second);
+    // Bucket bounds reach 2^32 ns and beyond, so the range column is as wide as two of the others.
+    cout << " " << setw(34) << left << "Latency (ns)" << setw(17) << "Calls" << setw(17) << "Share (%)" << "Histogram" << endl;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    for (const auto& [exponent, calls] : buckets) {
+        string range = "[" + to_string(1ULL << exponent) + ", " + to_string(1ULL << (exponent + 1)) + ")";
+        cout << " " << setw(34) << left << range
+             << setw(17) << calls
+             << setw(17) << fixed << setprecision(3) << (100.0 * calls / stats.count())
+             << string(max<size_t>(calls * 64 / largest, 1), '#') << endl;
+    }
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+}
+
+// Used when the out-of-place run would not fit the memory limit: times both in-place kernels on
+// a single matrix, transposing it back and forth.
+void runInPlaceBenchmark(size_t n, size_t blockSize) {
+    vector<vector<int>> A = makeIndexMatrix(n);
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    cout << " " << setw(18) << left << "Kernel"
+         << setw(20) << "Matrix Size (n)"
+         << setw(20) << "Block Size"
+         << setw(20) << "Time (ns)"
+         << setw(20) << "Correct" << endl;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    for (bool useBlock : { false, true }) {
+        auto timer = zen::timer();
+        timer.start();
+        if (useBlock)
+            inPlaceBlockTransposeMatrix(A, n, blockSize);
+        else
+            naiveInPlaceTransposeMatrix(A, n);
+        timer.stop();
+        bool correct = true;
+        for (size_t i = 0; i < n && correct; i++)
+            for (size_t j = 0; j < n && correct; j++)
+                correct = A[i][j] == indexValue(j, i, n);
+        cout << " " << setw(18) << left << (useBlock ? "in-place block" : "in-place naive")
+             << setw(20) << n
+             << setw(20) << (useBlock ? blockSize : 1)
+             << setw(20) << fixed << setprecision(2) << (timer.duration<zen::timer::nsec>().count() / 1000.0)
+             << setw(20) << (correct ? "yes" : "NO") << endl;
+        if (useBlock) break;
+        inPlaceBlockTransposeMatrix(A, n, blockSize);
+    }
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+}
+
+void runParallelBenchmark(size_t n, size_t blockSize, unsigned threadCount) {
+    vector<vector<int>> A = makeIndexMatrix(n);
+    vector<vector<int>> B(n, vector<int>(n, 0));
+    vector<vector<int>> expected(n, vector<int>(n, 0));
+    naiveTransposeMatrix(A, expected, n);
+
+    double blockTime = 0;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    cout << " " << setw(18) << left << "Kernel"
+         << setw(20) << "Matrix Size (n)"
+         << setw(20) << "Threads"
+         << setw(20) << "Time (ns)"
+         << setw(20) << "Speedup"
+         << setw(20) << "Correct" << endl;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    for (unsigned threads : { 1u, threadCount }) {
+        auto stats = zen::measure_statistics(3, [&] {
+            if (threads == 1)
+                blockTransposeMatrix(A, B, n, blockSize);
+            else
+                parallelBlockTransposeMatrix(A, B, n, TileShape{ blockSize, blockSize }, threads);
+        });
+        if (threads == 1)
+            blockTime = stats.median();
+        cout << " " << setw(18) << left << (threads == 1 ? "block" : "parallel block")
+             << setw(20) << n
+             << setw(20) << threads
+             << setw(20) << fixed << setprecision(2) << (stats.median() / 1000.0)
+             << setw(20) << fixed << setprecision(2) << (blockTime / stats.median())
+             << setw(20) << (B == expected ? "yes" : "NO") << endl;
+        if (threadCount == 1) break;
+    }
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+}
+
+// How much work a plan may spend on deciding: Estimate uses the cache model only, Measure times
+// the candidate kernels and tile shapes on scratch matrices of the plan's size.
+enum class PlanRigor { Estimate, Measure };
+
+// An n x n transpose decided once, in the spirit of an FFTW plan: creation reads the cache and TLB
+// parameters, picks the kernel and tile shape and allocates bounce scratch for `callers`
+// concurrent callers. execute() only dispatches on those decisions and never allocates. It is const
+// and safe to call from many threads at once; each concurrent caller borrows its own scratch
+// buffer, and a caller beyond `callers` runs the blocked kernel with the same tile instead.
+// The shared WorkerPool must already be sized: a plan never reconfigures it and uses at most as
+// many threads as it has. The pool runs one job at a time, so concurrent execute() calls of a
+// Parallel plan are safe but take turns rather than overlapping; an execute() from inside a pool
+// job (including a TransposeService band) runs its bands inline on the calling thread.
+class TransposePlan {
+public:
+    enum class Kernel { Small, Blocked, Bounce, Parallel };
+
+    TransposePlan(size_t n, PlanRigor rigor = PlanRigor::Estimate, unsigned threads = 1, unsigned callers = 1)
+        : n_(n), threads_(n <= maxSmallSize ? 1 : clamp(threads, 1u, WorkerPool::shared().size())) {
+        int l1CacheSizeKB, associativity, cacheLineSize, dtlbEntries, stlbEntries;
+        getCacheParameters(l1CacheSizeKB, associativity, cacheLineSize);
+        getTlbParameters(dtlbEntries, stlbEntries);
+        tile_ = calculateOptimalTileShape(l1CacheSizeKB, associativity, cacheLineSize, n, dtlbEntries);
+        kernel_ = n <= maxSmallSize ? Kernel::Small : threads_ > 1 ? Kernel::Parallel : Kernel::Blocked;
+
+        if (rigor == PlanRigor::Measure && kernel_ != Kernel::Small) {
+            vector<vector<int>> A = makeIndexMatrix(n);
+            vector<vector<int>> B(n, vector<int>(n, 0));
+            vector<TileShape> tiles = { tile_, tuneTileShape(A, B, n, cacheLineSize) };
+            vector<Kernel> kernels = { Kernel::Blocked, Kernel::Bounce };
+            if (threads_ > 1)
+                kernels.push_back(Kernel::Parallel);
+            double bestTime = numeric_limits<double>::max();
+            TileShape bestTile = tile_;
+            Kernel bestKernel = kernel_;
+            for (TileShape tile : tiles) {
+                allocateScratch(bounceScratchSize(tile), 1);
+                for (Kernel kernel : kernels) {
+                    kernel_ = kernel;
+                    tile_ = tile;
+                    double fastest = zen::measure_statistics(3, [&] { execute(A, B); }).min();
+                    if (fastest < bestTime) {
+                        bestTime = fastest;
+                        bestTile = tile;
+                        bestKernel = kernel;
+                    }
+                }
+            }
+            kernel_ = bestKernel;
+            tile_ = bestTile;
+        }
+        allocateScratch(bounceScratchSize(tile_), kernel_ == Kernel::Bounce ? max(callers, 1u) : 0);
+    }
+
+    TransposePlan(const TransposePlan&) = delete;
+    TransposePlan& operator=(const TransposePlan&) = delete;
+
+    void execute(const vector<vector<int>>& A, vector<vector<int>>& B) const {
+        switch (kernel_) {
+        case Kernel::Small:
+            smallTransposeMatrix(A, B, n_);
+            break;
+        case Kernel::Blocked:
+            blockTransposeMatrix(A, B, n_, tile_);
+            break;
+        case Kernel::Parallel: {
+            BandJob job = { this, &A, &B };
+            WorkerPool::shared().run((n_ + tile_.rows - 1) / tile_.rows, threads_, &BandJob::run, &job, "tile band");
+            break;
+        }
+        case Kernel::Bounce: {
+            vector<int>* scratch = acquireScratch();
+            if (!scratch) {
+                blockTransposeMatrix(A, B, n_, tile_);
+                break;
+            }
+            bounceTransposeMatrix(A, B, n_, tile_, TileOrder::Row, false, scratch->data());
+            releaseScratch(scratch);
+            break;
+        }
+        }
+    }
+
+    size_t size() const { return n_; }
+    Kernel kernel() const { return kernel_; }
+    TileShape tile() const { return tile_; }
+    unsigned threads() const { return kernel_ == Kernel::Parallel ? threads_ : 1; }
+
+    static const char* kernelName(Kernel kernel) {
+        switch (kernel) {
+        case Kernel::Small:    return "small";
+        case Kernel::Blocked:  return "blocked";
+        case Kernel::Bounce:   return "bounce";
+        case Kernel::Parallel: return "parallel";
+        }
+        return "?";
+    }
+
+    string describe() const {
+        ostringstream out;
+        if (kernel_ == Kernel::Small)
+            return "small (specialised for n = " + to_string(n_) + ")";
+        out << kernelName(kernel_) << ", tile " << tile_.rows << "x" << tile_.cols << ", " << threads() << " thread(s)";
+        return out.str();
+    }
+
+private:
+    // The parallel kernel's pool job, bound to a plain function so execute() builds no std::function.
+    struct BandJob {
+        const TransposePlan* plan;
+        const vector<vector<int>>* A;
+        vector<vector<int>>* B;
+
+        static void run(void* context, size_t band) {
+            BandJob& job = *static_cast<BandJob*>(context);
+            blockTransposeBand(*job.A, *job.B, job.plan->n_, job.plan->tile_, band);
+        }
+    };
+
+    // The free list is reserved for every buffer, so releasing one never allocates either.
+    void allocateScratch(size_t size, unsigned count) {
+        scratch_.assign(count, vector<int>(size));
+        freeScratch_.clear();
+        freeScratch_.reserve(count);
+        for (auto& buffer : scratch_)
+            freeScratch_.push_back(&buffer);
+    }
+
+    vector<int>* acquireScratch() const {
+        lock_guard<mutex> lock(scratchMutex_);
+        if (freeScratch_.empty())
+            return nullptr;
+        vector<int>* scratch = freeScratch_.back();
+        freeScratch_.pop_back();
+        return scratch;
+    }
+
+    void releaseScratch(vector<int>* scratch) const {
+        lock_guard<mutex> lock(scratchMutex_);
+        freeScratch_.push_back(scratch);
+    }
+
+    size_t n_;
+    unsigned threads_;
+    TileShape tile_ = { 1, 1 };
+    Kernel kernel_ = Kernel::Blocked;
+    vector<vector<int>> scratch_;
+    mutable mutex scratchMutex_;
+    mutable vector<vector<int>*> freeScratch_;
+};
+
+// Compares making the plan's decision on every call (cache and TLB detection, tile model, blocked
+// kernel) with executing a plan built once, then runs the plan from `threadCount` client threads
+// at the same time.
+void runPlanBenchmark(size_t n, PlanRigor rigor, unsigned threadCount, size_t calls) {
+    auto creation = zen::timer();
+    creation.start();
+    TransposePlan plan(n, rigor, threadCount, max(threadCount, 1u));
+    creation.stop();
+    cout << "Plan for n = " << n << " (" << (rigor == PlanRigor::Measure ? "measure" : "estimate") << "): "
+         << plan.describe() << ", created in " << fixed << setprecision(2)
+         << creation.duration<zen::timer::nsec>().count() / 1e6 << " ms" << endl;
+
+    vector<vector<int>> A = makeIndexMatrix(n);
+    vector<vector<int>> B(n, vector<int>(n, 0));
+    // The baseline re-derives every decision per call but stays quiet: the fallback warnings were
+    // already printed when the plan was made, and stderr I/O would only inflate the unplanned time.
+    auto unplanned = zen::measure_statistics(calls, [&] {
+        string source;
+        vector<CacheLevel> caches = detectCacheHierarchy(currentCpu(), source);
+        int l1CacheSizeKB, associativity, cacheLineSize, dtlbEntries, stlbEntries;
+        getCacheParameters(l1CacheSizeKB, associativity, cacheLineSize, caches, true);
+        getTlbParameters(dtlbEntries, stlbEntries, true);
+        blockTransposeMatrix(A, B, n, calculateOptimalTileShape(l1CacheSizeKB, associativity, cacheLineSize, n, dtlbEntries));
+    });
+    bool unplannedCorrect = isTransposeOf(A, B, n);
+    auto planned = zen::measure_statistics(calls, [&] { plan.execute(A, B); });
+    bool plannedCorrect = isTransposeOf(A, B, n);
+
+    vector<vector<vector<int>>> outputs(max(threadCount, 1u), vector<vector<int>>(n, vector<int>(n, 0)));
+    auto concurrent = zen::timer();
+    concurrent.start();
+    vector<thread> clients;
+    for (auto& output : outputs)
+        clients.emplace_back([&] {
+            for (size_t call = 0; call < calls; call++)
+                plan.execute(A, output);
+        });
+    for (auto& client : clients)
+        client.join();
+    concurrent.stop();
+    bool concurrentCorrect = all_of(outputs.begin(), outputs.end(), [&](const auto& output) { return isTransposeOf(A, output, n); });
+
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    cout << " " << setw(18) << left << "Mode"
+         << setw(20) << "Matrix Size (n)"
+         << setw(20) << "Calls"
+         << setw(20) << "Per Call (us)"
+         << setw(20) << "Correct" << endl;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    cout << " " << setw(18) << left << "unplanned" << setw(20) << n << setw(20) << calls
+         << setw(20) << fixed << setprecision(2) << unplanned.median() / 1000.0 << setw(20) << (unplannedCorrect ? "yes" : "NO") << endl;
+    cout << " " << setw(18) << left << "plan" << setw(20) << n << setw(20) << calls
+         << setw(20) << fixed << setprecision(2) << planned.median() / 1000.0 << setw(20) << (plannedCorrect ? "yes" : "NO") << endl;
+    cout << " " << setw(18) << left << ("plan x " + to_string(outputs.size()) + " clients") << setw(20) << n << setw(20) << calls * outputs.size()
+         << setw(20) << fixed << setprecision(2) << concurrent.duration<zen::timer::nsec>().count() / 1000.0 / (calls * outputs.size())
+         << setw(20) << (concurrentCorrect ? "yes" : "NO") << endl;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+}
+
+// Latency per call for every n in [1, maxN]: the generic path (cache lookup, block-size model,
+// tile loops), the naive loop, and the fast path (n <= 64 kernels, generic above that).
+void runSmallBenchmark(size_t maxN) {
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    cout << " " << setw(18) << left << "Matrix Size (n)"
+         << setw(20) << "Generic (ns/call)"
+         << setw(20) << "Naive (ns/call)"
+         << setw(20) << "Fast Path (ns/call)"
+         << setw(20) << "Speedup"
+         << setw(20) << "Correct" << endl;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    auto generic = [](const vector<vector<int>>& A, vector<vector<int>>& B, size_t n) {
+        int l1CacheSizeKB, associativity, cacheLineSize;
+        getCacheParameters(l1CacheSizeKB, associativity, cacheLineSize);
+        blockTransposeMatrix(A, B, n, calculateOptimalBlockSize(l1CacheSizeKB, associativity, cacheLineSize, n));
+    };
+    for (size_t n = 1; n <= maxN; n++) {
+        vector<vector<int>> A = makeIndexMatrix(n);
+        vector<vector<int>> B(n, vector<int>(n, 0));
+        size_t batch = max<size_t>(1, 16384 / (n * n));
+        auto perCall = [&](auto&& run) {
+            return zen::measure_statistics(31, [&] {
+                for (size_t call = 0; call < batch; call++)
+                    run();
+            }).median() / batch;
+        };
+        double genericNs = perCall([&] { generic(A, B, n); });
+        double naiveNs = perCall([&] { naiveTransposeMatrix(A, B, n); });
+        fill(B.begin(), B.end(), vector<int>(n, 0));
+        double fastNs = perCall([&] {
+            if (!smallTransposeMatrix(A, B, n))
+                generic(A, B, n);
+        });
+        cout << " " << setw(18) << left << n << fixed << setprecision(2)
+             << setw(20) << genericNs
+             << setw(20) << naiveNs
+             << setw(20) << fastNs
+             << setw(20) << genericNs / fastNs
+             << setw(20) << (isTransposeOf(A, B, n) ? "yes" : "NO") << endl;
+    }
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+}
+
+enum class Algorithm { Small, Naive, Blocked, Recursive, Simd, Parallel, Count };
+
+const char* algorithmName(Algorithm algorithm) {
+    switch (algorithm) {
+    case Algorithm::Small:     return "small";
+    case Algorithm::Naive:     return "naive";
+    case Algorithm::Blocked:   return "blocked";
+    case Algorithm::Recursive: return "recursive";
+    case Algorithm::Simd:      return "simd";
+    case Algorithm::Parallel:  return "parallel";
+    case Algorithm::Count:     break;
+    }
+    return "?";
+}
+
+// Why choose() picked what it did; explainChoice turns it into text so choose() builds no strings.
+enum class ChoiceBasis { SmallKernel, Uncalibrated, SavedCalibration, FreshCalibration };
+
+struct TransposeChoice {
+    Algorithm algorithm = Algorithm::Naive;
+    TileShape tile = { 1, 1 };
+    unsigned threads = 1;
+    array<double, static_cast<size_t>(Algorithm::Count)> predictedNs{};  // 0 = not a candidate
+    ChoiceBasis basis = ChoiceBasis::Uncalibrated;
+};
+
+// Picks the transpose algorithm for an n x n int matrix from a cost model calibrated once per
+// machine: each algorithm is timed at a ladder of sizes (the parallel one also at 2, 4, ... up to
+// the thread budget), the cost per element is interpolated in log2(n) between them, and the
+// cheapest prediction wins. Calibration is an explicit step; until it has run, choose() falls back
+// to the blocked kernel with the model tile. The calibration is saved to a file keyed by the cache
+// hierarchy and thread budget, so later runs on the same machine skip it. Each calibration is
+// published as an immutable Model behind a plain atomic pointer, so choose() is one acquire load
+// plus arithmetic: no lock, no reference counting, no copy and no allocation. Superseded models are
+// retired rather than freed (there are only as many as calibrations), so a reader never sees one die.
+class TransposeSelector {
+public:
+    static TransposeSelector& shared() {
+        static TransposeSelector selector;
+        return selector;
+    }
+
+    void setCalibrationPath(const string& path) {
+        lock_guard<mutex> lock(mutex_);
+        path_ = path;
+    }
+
+    string calibrationPath() const {
+        lock_guard<mutex> lock(mutex_);
+        return path_;
+    }
+
+    // The most threads the parallel kernel may use; a different budget invalidates the calibration.
+    void setThreads(unsigned threads) {
+        lock_guard<mutex> lock(mutex_);
+        if (max(threads, 1u) == threads_) return;
+        threads_ = max(threads, 1u);
+        calibrated_ = false;
+        model_.store(nullptr, memory_order_release);
+    }
+
+    // Loads the saved calibration if it matches this machine, otherwise measures and saves it.
+    void calibrate(bool force = false) {
+        lock_guard<mutex> lock(mutex_);
+        if (calibrated_ && !force) return;
+        if (!force && load()) {
+            calibrated_ = true;
+            publish();
+            return;
+        }
+        cout << "Calibrating transpose cost model (once per machine)..." << endl;
+        costs_.clear();
+        for (size_t n : calibrationSizes) {
+            // Sizes ascend, so inside a tight cgroup the model just stops at the largest that fits.
+            if (exceedsMemoryLimit(2 * squareMatrixBytes(n)))
+                break;
+            vector<vector<int>> A = makeIndexMatrix(n);
+            vector<vector<int>> B(n, vector<int>(n, 0));
+            TileShape tile = tileFor(n);
+            for (size_t a = 0; a < static_cast<size_t>(Algorithm::Count); a++) {
+                Algorithm algorithm = static_cast<Algorithm>(a);
+                if (algorithm == Algorithm::Small) continue;
+                for (unsigned threads : threadLadder(algorithm)) {
+                    double fastest = zen::measure_statistics(3, [&] { run(algorithm, A, B, n, tile, threads); }).min();
+                    costs_[{ algorithm, threads }].push_back({ n, fastest / (static_cast<double>(n) * n) });
+                }
+            }
+        }
+        calibrated_ = true;
+        loadedFromFile_ = false;
+        save();
+        publish();
+    }
+
+    TransposeChoice choose(size_t n) const {
+        TransposeChoice choice;
+        choice.tile = tileFor(n);
+        if (n <= maxSmallSize) {
+            choice.algorithm = Algorithm::Small;
+            choice.basis = ChoiceBasis::SmallKernel;
+            return choice;
+        }
+        const Model* model = model_.load(memory_order_acquire);
+        if (!model) {
+            choice.algorithm = Algorithm::Blocked;
+            choice.basis = ChoiceBasis::Uncalibrated;
+            return choice;
+        }
+        double log2n = log2(static_cast<double>(n));
+        double best = numeric_limits<double>::max();
+        for (const Curve& curve : model->curves) {
+            double predicted = curve.nsPerElementAt(log2n) * static_cast<double>(n) * n;
+            double& shown = choice.predictedNs[static_cast<size_t>(curve.algorithm)];
+            shown = shown > 0 ? min(shown, predicted) : predicted;
+            if (predicted < best) {
+                best = predicted;
+                choice.algorithm = curve.algorithm;
+                choice.threads = curve.threads;
+            }
+        }
+        choice.basis = model->loadedFromFile ? ChoiceBasis::SavedCalibration : ChoiceBasis::FreshCalibration;
+        return choice;
+    }
+
+    static void run(Algorithm algorithm, const vector<vector<int>>& A, vector<vector<int>>& B, size_t n, TileShape tile, unsigned threads) {
+        switch (algorithm) {
+        case Algorithm::Small:
+            if (smallTransposeMatrix(A, B, n)) break;
+            [[fallthrough]];
+        case Algorithm::Blocked:   blockTransposeMatrix(A, B, n, tile); break;
+        case Algorithm::Naive:     naiveTransposeMatrix(A, B, n); break;
+        case Algorithm::Recursive: recursiveTransposeMatrix(A, B, n); break;
+        case Algorithm::Simd:      simdBlockTransposeMatrix(A, B, n, tile); break;
+        case Algorithm::Parallel:  parallelBlockTransposeMatrix(A, B, n, tile, threads); break;
+        case Algorithm::Count:     break;
+        }
+    }
+
+private:
+    struct CostPoint { size_t n; double nsPerElement; };
+    using CostKey = pair<Algorithm, unsigned>;  // algorithm, threads
+
+    // One (algorithm, threads) cost curve with its sizes already in log2, interpolated linearly.
+    struct Curve {
+        Algorithm algorithm;
+        unsigned threads;
+        vector<double> log2n;
+        vector<double> nsPerElement;
+
+        double nsPerElementAt(double x) const {
+            if (x <= log2n.front()) return nsPerElement.front();
+            if (x >= log2n.back()) return nsPerElement.back();
+            size_t k = 1;
+            while (x > log2n[k])
+                k++;
+            double t = (x - log2n[k - 1]) / (log2n[k] - log2n[k - 1]);
+            return nsPerElement[k - 1] + t * (nsPerElement[k] - nsPerElement[k - 1]);
+        }
+    };
+
+    struct Model {
+        vector<Curve> curves;
+        bool loadedFromFile;
+    };
+
+    // Callers hold mutex_. Swaps in a new immutable model built from costs_ for choose() to read.
+    void publish() {
+        auto model = make_unique<Model>();
+        model->loadedFromFile = loadedFromFile_;
+        for (const auto& [key, points] : costs_) {
+            if (points.empty()) continue;
+            Curve curve{ key.first, key.second, {}, {} };
+            for (const auto& point : points) {
+                curve.log2n.push_back(log2(static_cast<double>(point.n)));
+                curve.nsPerElement.push_back(point.nsPerElement);
+            }
+            model->curves.push_back(move(curve));
+        }
+        model_.store(model.get(), memory_order_release);
+        models_.push_back(move(model));
+    }
+
+    static constexpr size_t calibrationSizes[] = { 128, 256, 512, 1024, 2048, 4096 };
+
+    // 1 for the serial kernels; 2, 4, 8, ... and the budget itself for the parallel one.
+    vector<unsigned> threadLadder(Algorithm algorithm) const {
+        if (algorithm != Algorithm::Parallel)
+            return { 1 };
+        vector<unsigned> ladder;
+        for (unsigned threads = 2; threads < threads_; threads *= 2)
+            ladder.push_back(threads);
+        if (threads_ > 1)
+            ladder.push_back(threads_);
+        return ladder;
+    }
+
+    TransposeSelector() : threads_(defaultThreadCount()) {
+        int l1CacheSizeKB, associativity, cacheLineSize;
+        getCacheParameters(l1CacheSizeKB, associativity, cacheLineSize);
+        l1CacheSizeKB_ = l1CacheSizeKB;
+        associativity_ = associativity;
+        cacheLineSize_ = cacheLineSize;
+    }
+
+    TileShape tileFor(size_t n) const {
+        return calculateOptimalTileShape(l1CacheSizeKB_, associativity_, cacheLineSize_, n);
+    }
+
+    // "format 2" marks the per-thread-count point lines, so files from before the ladder are redone.
+    string signature() const {
+        return "format 2 | " + formatCacheHierarchy() + " | threads " + to_string(threads_);
+    }
+
+    // Format: a "signature" line, then one "<algorithm> <threads> <n> <ns per element>" line per point.
+    bool load() {
+        ifstream file(path_);
+        string line;
+        if (!getline(file, line) || line != "signature " + signature())
+            return false;
+        map<CostKey, vector<CostPoint>> costs;
+        string name;
+        unsigned threads;
+        CostPoint point;
+        while (file >> name >> threads >> point.n >> point.nsPerElement) {
+            for (size_t a = 0; a < static_cast<size_t>(Algorithm::Count); a++)
+                if (name == algorithmName(static_cast<Algorithm>(a)))
+                    costs[{ static_cast<Algorithm>(a), threads }].push_back(point);
+        }
+        if (costs.empty())
+            return false;
+        costs_ = move(costs);
+        loadedFromFile_ = true;
+        return true;
+    }
+
+    void save() const {
+        ofstream file(path_);
+        if (!file) {
+            cerr << "Could not write calibration to " << path_ << endl;
+            return;
+        }
+        file << "signature " << signature() << "\n";
+        for (const auto& [key, points] : costs_)
+            for (const auto& point : points)
+                file << algorithmName(key.first) << " " << key.second << " " << point.n << " " << point.nsPerElement << "\n";
+    }
+
+    mutable mutex mutex_;
+    string path_ = "transpose_calibration.txt";
+    bool calibrated_ = false;
+    bool loadedFromFile_ = false;
+    unsigned threads_;
+    int l1CacheSizeKB_, associativity_, cacheLineSize_;
+    map<CostKey, vector<CostPoint>> costs_;
+    atomic<const Model*> model_{ nullptr };
+    vector<unique_ptr<const Model>> models_;  // every model ever published, kept for model_'s readers
+};
+
+// The one entry point: lets the selector pick the algorithm, tile shape and thread count for A's
+// size, then runs it. It never calibrates or touches the file system; call
+// TransposeSelector::shared().calibrate() once beforehand to enable the measured cost model.
+// B must already be A.size() x A.size().
+TransposeChoice transpose(const vector<vector<int>>& A, vector<vector<int>>& B) {
+    TransposeChoice choice = TransposeSelector::shared().choose(A.size());
+    TransposeSelector::run(choice.algorithm, A, B, A.size(), choice.tile, choice.threads);
+    return choice;
+}
+
+void explainChoice(size_t n, const TransposeChoice& choice) {
+    cout << "transpose(A, B) for n = " << n << ": " << algorithmName(choice.algorithm);
+    if (choice.algorithm != Algorithm::Small && choice.algorithm != Algorithm::Naive && choice.algorithm != Algorithm::Recursive)
+        cout << ", tile " << choice.tile.rows << "x" << choice.tile.cols;
+    cout << ", " << choice.threads << " thread(s) (";
+    switch (choice.basis) {
+    case ChoiceBasis::SmallKernel:
+        cout << "n <= " << maxSmallSize << ": fixed-size kernel, no model or threads";
+        break;
+    case ChoiceBasis::Uncalibrated:
+        cout << "not calibrated yet: blocked with the model tile";
+        break;
+    case ChoiceBasis::SavedCalibration:
+    case ChoiceBasis::FreshCalibration:
+        cout << "lowest predicted cost from the " << (choice.basis == ChoiceBasis::SavedCalibration ? "saved" : "fresh")
+             << " calibration in " << TransposeSelector::shared().calibrationPath();
+        break;
+    }
+    cout << ")" << endl;
+    bool any = any_of(choice.predictedNs.begin(), choice.predictedNs.end(), [](double ns) { return ns > 0; });
+    if (!any) return;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    cout << " " << setw(18) << left << "Algorithm" << setw(20) << "Predicted (us)" << setw(20) << "Chosen" << endl;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    for (size_t a = 0; a < choice.predictedNs.size(); a++) {
+        if (choice.predictedNs[a] <= 0) continue;
+        cout << " " << setw(18) << left << algorithmName(static_cast<Algorithm>(a))
+             << setw(20) << fixed << setprecision(2) << choice.predictedNs[a] / 1000.0
+             << setw(20) << (static_cast<size_t>(choice.algorithm) == a ? "yes" : "") << endl;
+    }
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+}
+
+// Transposes rows [i, iEnd) of A into columns [i, iEnd) of B, bouncing each tile through the
+// caller's scratch (bounceScratchSize(tile) ints) so B is written in whole rows.
+void transposeBand(const vector<vector<int>>& A, vector<vector<int>>& B, size_t n, TileShape tile,
+                   size_t i, size_t iEnd, int* scratch) {
+    size_t pitch = bouncePitch(tile);
+    int* buffer = reinterpret_cast<int*>((reinterpret_cast<uintptr_t>(scratch) + 63) & ~uintptr_t(63));
+    for (size_t j = 0; j < n; j += tile.cols) {
+        size_t jEnd = min(j + tile.cols, n);
+        for (size_t bi = i; bi < iEnd; bi++) {
+            const int* row = A[bi].data();
+            for (size_t bj = j; bj < jEnd; bj++)
+                buffer[(bj - j) * pitch + (bi - i)] = row[bj];
+        }
+        for (size_t bj = j; bj < jEnd; bj++)
+            copyRow(B[bj].data() + i, buffer + (bj - j) * pitch, iEnd - i, false);
+    }
+}
+
+// One process-wide executor for transposes submitted concurrently from many threads. Jobs are cut
+// into tile-row bands and shared out by start-time fair queuing: each band advances its job's
+// virtual time by elements / weight, and idle workers always take a band from the job with the
+// smallest virtual time. A new job starts at the current virtual clock, so it neither waits for
+// earlier jobs to finish nor gets credit for time it was not queued. The bands run on the shared
+// WorkerPool, with the service's one driver thread as worker 0, so the pool size caps total
+// parallelism across the service and every parallel kernel. The driver holds the pool for one
+// scheduling round at a time (at most one band per pool thread) and then queues for its next
+// turn, so parallelFor, parallel plans and transpose() callers take turns with the service instead
+// of waiting for its queue to drain. Each thread keeps its own bounce scratch.
+class TransposeService {
+public:
+    struct Result {
+        double queueNs;   // submit to first band started
+        double totalNs;   // submit to last band finished
+    };
+
+    static TransposeService& shared() {
+        static TransposeService service;
+        return service;
+    }
+
+    ~TransposeService() {
+        {
+            lock_guard<mutex> lock(mutex_);
+            shutdown_ = true;
+        }
+        wake_.notify_all();
+        driver_.join();
+    }
+
+    unsigned workers() const { return WorkerPool::shared().size(); }
+
+    // A and B must stay alive until the returned future is ready. Throws invalid_argument when B
+    // (or a row of A or B) is too small for an A.size() x A.size() transpose.
+    future<Result> submit(const vector<vector<int>>& A, vector<vector<int>>& B, double weight = 1.0) {
+        size_t n = A.size();
+        if (B.size() < n)
+            throw invalid_argument("TransposeService: B has " + to_string(B.size()) + " rows, needs " + to_string(n));
+        for (size_t k = 0; k < n; k++)
+            if (A[k].size() < n || B[k].size() < n)
+                throw invalid_argument("TransposeService: row " + to_string(k) + " of A or B is shorter than " + to_string(n));
+
+        auto job = make_shared<Job>();
+        job->A = &A;
+        job->B = &B;
+        job->n = n;
+        job->tile = tileFor(n);
+        job->bands = n <= maxSmallSize ? 1 : (n + job->tile.rows - 1) / job->tile.rows;
+        job->weight = weight > 0 ? weight : 1.0;
+        job->submitted = chrono::steady_clock::now();
+        future<Result> result = job->done.get_future();
+        {
+            lock_guard<mutex> lock(mutex_);
+            job->virtualTime = virtualClock_;
+            active_.push_back(job);
+        }
+        wake_.notify_one();
+        return result;
+    }
+
+private:
+    struct Job {
+        const vector<vector<int>>* A;
+        vector<vector<int>>* B;
+        size_t n;
+        TileShape tile;
+        size_t bands;
+        size_t nextBand = 0;
+        size_t finishedBands = 0;
+        double weight;
+        double virtualTime = 0;
+        chrono::steady_clock::time_point submitted, started;
+        promise<Result> done;
+    };
+
+    // Touching the pool first makes it outlive the service, whose destructor still drains into it.
+    TransposeService() {
+        getCacheParameters(l1CacheSizeKB_, associativity_, cacheLineSize_);
+        WorkerPool::shared();
+        driver_ = thread([this] { drive(); });
+    }
+
+    TileShape tileFor(size_t n) const {
+        return calculateOptimalTileShape(l1CacheSizeKB_, associativity_, cacheLineSize_, n);
+    }
+
+    bool hasQueuedBand() const {
+        return any_of(active_.begin(), active_.end(), [](const auto& job) { return job->nextBand < job->bands; });
+    }
+
+    // Runs one scheduling round per pool turn while bands are queued: each pool thread takes at
+    // most one band, then the pool goes to whoever queued for it next. Shutdown waits for the
+    // queue to drain, so no accepted job is dropped.
+    void drive() {
+        TraceRecorder::instance().registerThread();
+        unique_lock<mutex> lock(mutex_);
+        while (true) {
+            wake_.wait(lock, [this] { return shutdown_ || hasQueuedBand(); });
+            if (!hasQueuedBand())
+                return;
+            lock.unlock();
+            unsigned participants = WorkerPool::shared().size();
+            WorkerPool::shared().run(participants, participants, &TransposeService::runBand, this, "service");
+            lock.lock();
+        }
+    }
+
+    static void runBand(void* context, size_t) {
+        static_cast<TransposeService*>(context)->runBand();
+    }
+
+    void runBand() {
+        thread_local vector<int> scratch;
+        unique_lock<mutex> lock(mutex_);
+        if (!hasQueuedBand())
+            return;
+        shared_ptr<Job> job;
+        for (const auto& candidate : active_)
+            if (candidate->nextBand < candidate->bands && (!job || candidate->virtualTime < job->virtualTime))
+                job = candidate;
+        size_t band = job->nextBand++;
+        if (band == 0)
+            job->started = chrono::steady_clock::now();
+        virtualClock_ = job->virtualTime;
+        size_t rowsPerBand = job->bands == 1 ? job->n : job->tile.rows;
+        job->virtualTime += static_cast<double>(rowsPerBand) * job->n / job->weight;
+        lock.unlock();
+
+        size_t i = band * rowsPerBand;
+        size_t iEnd = min(i + rowsPerBand, job->n);
+        if (job->bands == 1 && smallTransposeMatrix(*job->A, *job->B, job->n)) {
+            // n <= 64: the whole job is one fixed-size kernel call.
+        } else {
+            if (scratch.size() < bounceScratchSize(job->tile))
+                scratch.resize(bounceScratchSize(job->tile));
+            transposeBand(*job->A, *job->B, job->n, job->tile, i, iEnd, scratch.data());
+        }
+
+        lock.lock();
+        if (++job->finishedBands == job->bands) {
+            active_.erase(find(active_.begin(), active_.end(), job));
+            auto now = chrono::steady_clock::now();
+            job->done.set_value({ static_cast<double>(chrono::duration_cast<chrono::nanoseconds>(job->started - job->submitted).count()),
+                                  static_cast<double>(chrono::duration_cast<chrono::nanoseconds>(now - job->submitted).count()) });
+        }
+    }
+
+    mutex mutex_;
+    condition_variable wake_;
+    thread driver_;
+    vector<shared_ptr<Job>> active_;
+    double virtualClock_ = 0;
+    bool shutdown_ = false;
+    int l1CacheSizeKB_, associativity_, cacheLineSize_;
+};
+
+// Many-client load generator: client k submits `jobsPerClient` transposes of one size (64, 256 or
+// 1024 by k % 3) with weight 1 + k % 2, each waiting for the previous to finish, all at once.
+bool runServiceBenchmark(unsigned clients, size_t jobsPerClient) {
+    const size_t sizes[] = { 64, 256, 1024 };
+    size_t requiredBytes = 0;
+    for (size_t n : sizes)
+        requiredBytes += squareMatrixBytes(n);
+    for (unsigned k = 0; k < clients; k++)
+        requiredBytes += squareMatrixBytes(sizes[k % 3]);
+    if (!fitsMemoryLimit(requiredBytes, "--service"))
+        return false;
+    map<size_t, vector<vector<int>>> inputs;
+    for (size_t n : sizes)
+        inputs[n] = makeIndexMatrix(n);
+
+    TransposeService& service = TransposeService::shared();
+
+    struct ClientStats {
+        size_t n;
+        double weight;
+        vector<double> queueNs, totalNs;
+        bool correct = true;
+        double elapsedNs = 0;
+    };
+    vector<ClientStats> stats(clients);
+    auto begin = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (unsigned k = 0; k < clients; k++) {
+        stats[k].n = sizes[k % 3];
+        stats[k].weight = 1.0 + k % 2;
+        threads.emplace_back([&, k] {
+            ClientStats& mine = stats[k];
+            const auto& A = inputs[mine.n];
+            vector<vector<int>> B(mine.n, vector<int>(mine.n, 0));
+            auto clientBegin = chrono::steady_clock::now();
+            for (size_t job = 0; job < jobsPerClient; job++) {
+                TransposeService::Result result = service.submit(A, B, mine.weight).get();
+                mine.queueNs.push_back(result.queueNs);
+                mine.totalNs.push_back(result.totalNs);
+            }
+            mine.elapsedNs = static_cast<double>(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - clientBegin).count());
+            mine.correct = isTransposeOf(A, B, mine.n);
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    double wallNs = static_cast<double>(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - begin).count());
+
+    cout << "Transpose service: " << service.workers() << " worker(s), " << clients << " client(s), "
+         << jobsPerClient << " job(s) per client" << endl;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    cout << " " << setw(18) << left << "Client"
+         << setw(17) << "Matrix Size (n)"
+         << setw(8) << "Weight"
+         << setw(14) << "Jobs/s"
+         << setw(14) << "Melem/s"
+         << setw(16) << "Queue p50 (us)"
+         << setw(16) << "Queue p99 (us)"
+         << setw(18) << "Latency p50 (us)"
+         << setw(10) << "Correct" << endl;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    double totalElements = 0;
+    size_t totalJobs = 0;
+    bool allCorrect = true;
+    for (unsigned k = 0; k < clients; k++) {
+        const ClientStats& client = stats[k];
+        zen::execution_stats queue(client.queueNs), total(client.totalNs);
+        double elements = static_cast<double>(client.n) * client.n * jobsPerClient;
+        totalElements += elements;
+        totalJobs += jobsPerClient;
+        allCorrect = allCorrect && client.correct;
+        cout << " " << setw(18) << left << k
+             << setw(17) << client.n
+             << setw(8) << fixed << setprecision(0) << client.weight
+             << setw(14) << setprecision(1) << jobsPerClient / (client.elapsedNs / 1e9)
+             << setw(14) << setprecision(1) << elements / (client.elapsedNs / 1e3)
+             << setw(16) << setprecision(2) << queue.median() / 1000.0
+             << setw(16) << queue.percentile(99) / 1000.0
+             << setw(18) << total.median() / 1000.0
+             << setw(10) << (client.correct ? "yes" : "NO") << endl;
+    }
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    cout << "Total: " << fixed << setprecision(1) << totalJobs / (wallNs / 1e9) << " jobs/s, "
+         << totalElements / (wallNs / 1e3) << " Melem/s over " << setprecision(2) << wallNs / 1e6 << " ms"
+         << (allCorrect ? "" : " (INCORRECT RESULTS)") << endl;
+    return allCorrect;
+}
+
+// cpuinfo_max_freq of the given CPU in GHz, or 0 where cpufreq is not exposed (e.g. most VMs).
+double maxFrequencyGhz(int cpu) {
+    static mutex cacheMutex;
+    static map<int, double> byCpu;
+    lock_guard<mutex> lock(cacheMutex);
+    auto found = byCpu.find(cpu);
+    if (found == byCpu.end()) {
+        long kHz = cpu < 0 ? -1 : readSysfsNumber("/sys/devices/system/cpu/cpu" + to_string(cpu) + "/cpufreq/cpuinfo_max_freq");
+        found = byCpu.emplace(cpu, kHz > 0 ? kHz / 1e6 : 0.0).first;
+    }
+    return found->second;
+}
+
+// Runs a chain of dependent multiplies by a runtime 1 and divides by the elapsed nanoseconds.
+// imul r64, r64 has a 3-cycle latency on every x86 core since Nehalem (Intel) and Zen (AMD), and
+// unlike add-immediate chains it is not folded or eliminated at rename, so the chain runs at
+// exactly one multiply per three cycles. Elsewhere the loop falls back to dependent adds, one per
+// cycle on mainstream ARM cores. Only the TSC (or steady clock) is needed, so it works where perf
+// counters are unavailable. Returns 0 (unknown) when the compiler offers no way to keep the chain
+// or the result is above the CPU's cpuinfo_max_freq, which no real clock can be.
+double calibratedLoopGhz(uint64_t iterations = 1 << 15) {
+#if defined(__GNUC__)
+    volatile size_t one = 1;
+    size_t multiplier = one, x = 1;
+    auto timer = zen::timer();
+    timer.start();
+    for (uint64_t i = 0; i < iterations; i++) {
+#if defined(__x86_64__) || defined(__i386__)
+        __asm__ volatile("imul %1, %0\n\timul %1, %0\n\timul %1, %0\n\timul %1, %0\n\t"
+                         "imul %1, %0\n\timul %1, %0\n\timul %1, %0\n\timul %1, %0"
+                         : "+r"(x) : "r"(multiplier));
+#else
+        for (int k = 0; k < 8; k++) {
+            x += multiplier; __asm__ volatile("" : "+r"(x));
+        }
+#endif
+    }
+    timer.stop();
+#if defined(__x86_64__) || defined(__i386__)
+    const double cyclesPerStep = 3;
+#else
+    const double cyclesPerStep = 1;
+#endif
+    double ns = static_cast<double>(timer.duration<zen::timer::nsec>().count());
+    double ghz = ns > 0 && x != 0 ? 8.0 * iterations * cyclesPerStep / ns : 0;
+    double ceiling = maxFrequencyGhz(currentCpu());
+    return ceiling > 0 && ghz > ceiling * 1.05 ? 0 : ghz;
+#else
+    (void)iterations;
+    return 0;
+#endif
+}
+
+// Spins until three consecutive ~0.3 ms loop samples agree within 1%, so the first timed kernel
+// does not run while the core is still ramping up. Returns the settled frequency (0 if unknown).
+double stabiliseFrequency(chrono::milliseconds budget, chrono::milliseconds* elapsed = nullptr) {
+    auto begin = chrono::steady_clock::now();
+    double previous = 0, current = 0;
+    int stableSamples = 0;
+    while (chrono::steady_clock::now() - begin < budget) {
+        current = calibratedLoopGhz();
+        if (current <= 0) break;
+        stableSamples = previous > 0 && fabs(current - previous) <= 0.01 * previous ? stableSamples + 1 : 0;
+        previous = current;
+        if (stableSamples >= 2) break;
+    }
+    if (elapsed)
+        *elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - begin);
+    return current;
+}
+
+// Wall time of one run in TSC ticks and in core cycles, with the effective frequency behind them.
+struct RunCycles {
+    uint64_t tsc = 0;
+    double core = 0;
+    double ghz = 0;
+    const char* source = "none";
+};
+
+// What happened to the measuring thread during one timed run: the CPU it started and ended on,
+// how often it blocked (voluntary) or was preempted (involuntary), and how much of the wall time
+// it spent off the CPU. A short preemption by a kernel thread is tolerated; losing more than 5%
+// of the run is not.
+struct RunInterference {
+    int startCpu = -1;
+    int endCpu = -1;
+    long voluntarySwitches = 0;
+    long involuntarySwitches = 0;
+    double offCpuShare = 0;
+
+    bool migrated() const { return startCpu != endCpu; }
+    bool preempted() const { return involuntarySwitches > 0 && offCpuShare > 0.05; }
+    bool noisy() const { return migrated() || preempted(); }
+};
+
+class InterferenceMonitor {
+public:
+    void begin() {
+        result_ = RunInterference();
+        result_.startCpu = currentCpu();
+        switches(voluntary_, involuntary_);
+        cpuNs_ = threadCpuNs();
+        wallStart_ = chrono::steady_clock::now();
+    }
+
+    RunInterference end() {
+        double wallNs = static_cast<double>(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - wallStart_).count());
+        double cpuNs = static_cast<double>(threadCpuNs() - cpuNs_);
+        long voluntary = 0, involuntary = 0;
+        switches(voluntary, involuntary);
+        result_.endCpu = currentCpu();
+        result_.voluntarySwitches = voluntary - voluntary_;
+        result_.involuntarySwitches = involuntary - involuntary_;
+        result_.offCpuShare = wallNs > 0 && cpuNs > 0 ? max(0.0, 1.0 - cpuNs / wallNs) : 0;
+        return result_;
+    }
+
+private:
+    static int64_t threadCpuNs() {
+#ifdef __linux__
+        timespec now{};
+        if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now) == 0)
+            return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+#endif
+        return 0;
+    }
+
+    static void switches(long& voluntary, long& involuntary) {
+#ifdef __linux__
+        rusage usage{};
+        if (getrusage(RUSAGE_THREAD, &usage) == 0) {
+            voluntary = usage.ru_nvcsw;
+            involuntary = usage.ru_nivcsw;
+        }
+#else
+        voluntary = involuntary = 0;
+#endif
+    }
+
+    RunInterference result_;
+    long voluntary_ = 0;
+    long involuntary_ = 0;
+    int64_t cpuNs_ = 0;
+    chrono::steady_clock::time_point wallStart_;
+};
+
+// Counts the runs dropped because the thread migrated or was preempted while being timed.
+struct InterferenceTally {
+    size_t runs = 0;
+    size_t migrated = 0;
+    size_t preempted = 0;
+    size_t keptNoisy = 0;
+
+    void record(const RunInterference& run) {
+        runs++;
+        if (run.migrated()) migrated++;
+        else if (run.preempted()) preempted++;
+    }
+
+    size_t discarded() const { return migrated + preempted - keptNoisy; }
+
+    void report(ostream& out) const {
+        if (migrated + preempted == 0) return;
+        out << "Interference: discarded " << discarded() << " of " << runs << " timed run(s) ("
+            << migrated << " migrated, " << preempted << " preempted)";
+        if (keptNoisy > 0)
+            out << "; " << keptNoisy << " noisy run(s) kept after retries ran out";
+        out << endl;
+    }
+};
+
+// Like zen::measure_statistics, but a run that migrated or was preempted is discarded and repeated,
+// up to `repetitions` extra attempts. If that is not enough the noisy samples are kept and counted.
+template<class Operation, class Setup>
+zen::execution_stats measureClean(size_t repetitions, Operation&& operation, Setup&& setup, InterferenceTally& tally) {
+    vector<double> clean, noisy;
+    clean.reserve(repetitions);
+    InterferenceMonitor monitor;
+    for (size_t attempt = 0; clean.size() < repetitions && attempt < 2 * repetitions; attempt++) {
+        setup();
+        zen::timer t;
+        monitor.begin();
+        t.start();
+        operation();
+        t.stop();
+        RunInterference run = monitor.end();
+        tally.record(run);
+        (run.noisy() ? noisy : clean).push_back(static_cast<double>(t.duration<zen::timer::nsec>().count()));
+    }
+    for (size_t k = 0; clean.size() < repetitions && k < noisy.size(); k++, tally.keptNoisy++)
+        clean.push_back(noisy[k]);
+    return zen::execution_stats(move(clean));
+}
+
+template<class Operation>
+zen::execution_stats measureClean(size_t repetitions, Operation&& operation, InterferenceTally& tally) {
+    return measureClean(repetitions, forward<Operation>(operation), [] {}, tally);
+}
+
+// Times one run, retrying (up to four more times) while the run migrated or was preempted.
+// Core cycles come from perf when available, otherwise from the mean of calibrated loops run just
+// before and just after the kept run.
+auto measureTime(const vector<vector<int>>& A, vector<vector<int>>& B, size_t n, size_t blockSize, bool useBlock,
+                 RunCycles* cycles = nullptr, InterferenceTally* tally = nullptr) {
+    InterferenceMonitor monitor;
+    CycleCounters counters;
+    auto timer = zen::timer();
+    RunInterference run;
+    bool sampleLoop = cycles && !counters.available();
+    double ghzBefore = 0;
+    for (int attempt = 0; attempt < 5; attempt++) {
+        if (sampleLoop)
+            ghzBefore = calibratedLoopGhz();
+        monitor.begin();
+        counters.start();
+        timer.start();
+        if (useBlock)
+            blockTransposeMatrix(A, B, n, blockSize);
+        else
+            naiveTransposeMatrix(A, B, n);
+        timer.stop();
+        counters.stop();
+        run = monitor.end();
+        if (tally) tally->record(run);
+        if (!run.noisy()) break;
+    }
+    if (tally && run.noisy())
+        tally->keptNoisy++;
+    double ns = static_cast<double>(timer.duration<zen::timer::nsec>().count());
+    if (cycles) {
+        cycles->tsc = timer.cycles();
+        if (counters.coreCycles() > 0) {
+            cycles->core = static_cast<double>(counters.coreCycles());
+            if (counters.refCycles() > 0 && zen::tsc::invariant())
+                cycles->ghz = cycles->core / counters.refCycles() * zen::tsc::ghz();
+            else
+                cycles->ghz = ns > 0 ? cycles->core / ns : 0;
+            cycles->source = counters.refCycles() > 0 ? "perf cycles/ref-cycles" : "perf cycles";
+        } else {
+            double ghzAfter = calibratedLoopGhz();
+            cycles->ghz = ghzBefore > 0 && ghzAfter > 0 ? (ghzBefore + ghzAfter) / 2 : ghzAfter;
+            cycles->core = ns * cycles->ghz;
+            cycles->source = cycles->ghz > 0 ? "calibrated loop" : "calibrated loop above cpuinfo_max_freq";
+        }
+    }
+    return ns;
+}
+
+// Cold: A and B are flushed from every cache level. Warm: an untimed run leaves them as cached
+// as they fit. LLC-resident: after the untimed run a sweep larger than L2 evicts them from L1/L2.
+enum class CacheState { Cold, Warm, LlcResident };
+
+const char* cacheStateName(CacheState state) {
+    switch (state) {
+    case CacheState::Cold:        return "cold";
+    case CacheState::Warm:        return "warm";
+    case CacheState::LlcResident: return "llc-resident";
+    }
+    return "?";
+}
+
+bool parseCacheState(const string& text, CacheState& state) {
+    for (auto candidate : { CacheState::Cold, CacheState::Warm, CacheState::LlcResident }) {
+        if (text == cacheStateName(candidate)) {
+            state = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t cacheLevelSizeBytes(int level, size_t fallback) {
+    const CacheLevel* cache = findCacheLevel(level);
+    return cache ? cache->sizeBytes : fallback;
+}
+
+bool hasClflushopt() {
+    unsigned int eax, ebx, ecx, edx;
+    getCpuid(0, 0, eax, ebx, ecx, edx);
+    if (eax < 7) return false;
+    getCpuid(7, 0, eax, ebx, ecx, edx);
+    return (ebx >> 23) & 1;
+}
+
+#if defined(HAS_SSE2) && defined(__GNUC__)
+__attribute__((target("clflushopt")))
+#endif
+void flushRange(const void* data, size_t bytes, bool useClflushopt) {
+#ifdef HAS_SSE2
+    // Whole lines from the one holding the first byte to the one holding the last.
+    uintptr_t begin = reinterpret_cast<uintptr_t>(data) & ~uintptr_t(63);
+    uintptr_t end = (reinterpret_cast<uintptr_t>(data) + bytes + 63) & ~uintptr_t(63);
+    for (uintptr_t line = begin; line < end; line += 64) {
+        if (useClflushopt)
+            _mm_clflushopt(reinterpret_cast<char*>(line));
+        else
+            _mm_clflush(reinterpret_cast<const char*>(line));
+    }
+    _mm_mfence();
+#else
+    (void)data;
+    (void)bytes;
+    (void)useClflushopt;
+#endif
+}
+
+// Touches every line of a buffer of the given size, evicting whatever it displaces.
+void sweepCache(size_t bytes) {
+    static vector<char> sweep;
+    if (sweep.size() < bytes)
+        sweep.resize(bytes);
+    volatile char sink = 0;
+    for (size_t offset = 0; offset < bytes; offset += 64) {
+        sweep[offset]++;
+        sink = sink + sweep[offset];
+    }
+}
+
+void prepareCacheState(CacheState state, const vector<vector<int>>& A, vector<vector<int>>& B, const function<void()>& run) {
+    static const bool useClflushopt = hasClflushopt();
+    switch (state) {
+    case CacheState::Cold:
+#ifdef HAS_SSE2
+        for (const auto& row : A)
+            flushRange(row.data(), row.size() * sizeof(int), useClflushopt);
+        for (const auto& row : B)
+            flushRange(row.data(), row.size() * sizeof(int), useClflushopt);
+#else
+        sweepCache(2 * cacheLevelSizeBytes(3, 32 << 20));
+#endif
+        break;
+    case CacheState::Warm:
+        run();
+        break;
+    case CacheState::LlcResident:
+        run();
+        sweepCache(2 * cacheLevelSizeBytes(2, 1 << 20));
+        break;
+    }
+}
+
+// Median time of `iterations` runs, each preceded by preparing the requested cache state.
+double measureTimeInState(const vector<vector<int>>& A, vector<vector<int>>& B, size_t n, size_t blockSize, bool useBlock,
+                          CacheState state, int iterations, InterferenceTally& tally) {
+    auto run = [&]() {
+        if (useBlock)
+            blockTransposeMatrix(A, B, n, blockSize);
+        else
+            naiveTransposeMatrix(A, B, n);
+    };
+    return measureClean(iterations, run, [&] { prepareCacheState(state, A, B, run); }, tally).median();
+}
+
+
+int main(int argc, char** argv) {
+    // Capture the process mask before --core (or latency mode) pins this thread to one CPU.
+    allowedCpus();
+    zen::cmd_args args(argv, argc);
+    size_t n = 512;
+    if (args.is_present("--n")) {
+        auto num = std::stoll(args.get_options("--n")[0]);
+        if (num > 0)
+            n = static_cast<size_t>(num);
+    }
+    struct TraceOutput {
+        string path;
+        ~TraceOutput() {
+            if (!path.empty())
+                TraceRecorder::instance().writeChromeTrace(path);
+        }
+    } traceOutput;
+    if (args.is_present("--trace")) {
+        auto options = args.get_options("--trace");
+        traceOutput.path = options.empty() ? "transpose_trace.json" : options[0];
+        TraceRecorder::instance().enable(1 << 14, max(thread::hardware_concurrency(), 1u) + 1);
+        TraceRecorder::instance().setMainThread();
+    }
+
+    bool latencyMode = args.is_present("--latency-mode");
+    string selectionReason;
+    int selectedCore = -1;
+    if (args.is_present("--core") && !args.get_options("--core").empty()) {
+        selectedCore = std::stoi(args.get_options("--core")[0]);
+        selectionReason = "requested with --core";
+    }
+    if (selectedCore < 0 && latencyMode)
+        selectedCore = selectIsolatedCore(&selectionReason);
+    if (selectedCore < 0)
+        selectedCore = selectPerformanceCore(&selectionReason);
+    if (!pinToCore(selectedCore))
+        cerr << "Failed to pin to core " << selectedCore << ". Continuing without affinity." << endl;
+    else
+        cout << "Pinned to core " << selectedCore << " (" << selectionReason << ")" << endl;
+
+    int l1CacheSizeKB, associativity, cacheLineSize;
+    getCacheParameters(l1CacheSizeKB, associativity, cacheLineSize);
+    const ContainerLimits& container = containerLimits();
+    if (container.cpuQuota > 0 || container.cpusetCount > 0 || container.memoryLimit > 0) {
+        cout << "Container limits (cgroup " << container.version << "):";
+        if (container.cpuQuota > 0) cout << " cpu quota " << setprecision(2) << container.cpuQuota << " CPU(s)";
+        if (container.cpusetCount > 0) cout << " cpuset " << container.cpusetCount << " CPU(s)";
+        if (container.memoryLimit > 0) cout << " memory " << (container.memoryLimit >> 20) << " MB";
+        cout << endl;
+    }
+    string cacheSource;
+    cacheHierarchy(&cacheSource);
+    if (!cacheHierarchy().empty())
+        cout << "Cache hierarchy (" << cacheSource << "): " << formatCacheHierarchy() << endl;
+
+    size_t optimalBlockSize = calculateOptimalBlockSize(l1CacheSizeKB, associativity, cacheLineSize, n);
+
+    if (args.is_present("--spin-up")) {
+        chrono::milliseconds spinUp{};
+        double ghz = stabiliseFrequency(chrono::milliseconds(1000), &spinUp);
+        if (ghz > 0)
+            cout << "Frequency settled at " << fixed << setprecision(2) << ghz << " GHz after " << spinUp.count() << " ms spin-up" << endl;
+        else
+            cout << "Frequency unknown: the calibrated loop is unavailable or read above cpuinfo_max_freq" << endl;
+    }
+
+    if (latencyMode) {
+        int priority = 0;
+        if (args.is_present("--fifo")) {
+            auto options = args.get_options("--fifo");
+            priority = options.empty() ? 50 : std::stoi(options[0]);
+        }
+        size_t iterations = 100000;
+        if (args.is_present("--iterations") && std::stoi(args.get_options("--iterations")[0]) > 0)
+            iterations = std::stoul(args.get_options("--iterations")[0]);
+        size_t latencyN = args.is_present("--n") ? n : 64;
+        if (!fitsMemoryLimit(2 * squareMatrixBytes(latencyN), "--latency-mode"))
+            return 1;
+        enterLatencyMode(args.is_present("--fifo"), priority);
+        runLatencyBenchmark(latencyN, calculateOptimalBlockSize(l1CacheSizeKB, associativity, cacheLineSize, latencyN), iterations);
+        return 0;
+    }
+
+    if (args.is_present("--small")) {
+        auto options = args.get_options("--small");
+        size_t maxN = options.empty() ? 128 : std::stoul(options[0]);
+        if (!fitsMemoryLimit(2 * squareMatrixBytes(maxN), "--small"))
+            return 1;
+        runSmallBenchmark(maxN);
+        return 0;
+    }
+
+    if (args.is_present("--verify"))
+        return fitsMemoryLimit(2 * squareMatrixBytes(n), "--verify") && runVerification(n, optimalBlockSize) ? 0 : 1;
+
+    if (args.is_present("--bounce")) {
+        vector<size_t> sizes = { 512, 1024, 2048, 4096 };
+        if (args.is_present("--n"))
+            sizes = { n };
+        if (!fitsMemoryLimit(3 * squareMatrixBytes(*max_element(sizes.begin(), sizes.end())), "--bounce"))
+            return 1;
+        runBounceBenchmark(sizes, optimalBlockSize);
+        return 0;
+    }
+
+    if (args.is_present("--tlb")) {
+        if (!fitsMemoryLimit(3 * squareMatrixBytes(n), "--tlb"))
+            return 1;
+        runTlbBenchmark(n, optimalBlockSize);
+        return 0;
+    }
+
+    if (args.is_present("--tile-shape")) {
+        if (!fitsMemoryLimit(3 * squareMatrixBytes(n), "--tile-shape"))
+            return 1;
+        runTileShapeBenchmark(n, l1CacheSizeKB, associativity, cacheLineSize, optimalBlockSize);
+        return 0;
+    }
+
+    if (args.is_present("--tile-order")) {
+        if (!fitsMemoryLimit(3 * squareMatrixBytes(n), "--tile-order"))
+            return 1;
+        vector<TileOrder> orders = { TileOrder::Row, TileOrder::Column, TileOrder::Morton, TileOrder::Hilbert };
+        auto names = args.get_options("--tile-order");
+        if (!names.empty()) {
+            orders.clear();
+            for (const auto& name : names) {
+                TileOrder order;
+                if (parseTileOrder(name, order))
+                    orders.push_back(order);
+                else
+                    cerr << "Unknown tile order '" << name << "' (expected row, column, morton or hilbert)" << endl;
+            }
+        }
+        runTileOrderBenchmark(n, optimalBlockSize, orders);
+        return 0;
+    }
+
+    if (args.is_present("--permute")) {
+        vector<size_t> shape = { 16, 64, 64, 32 };
+        if (args.is_present("--shape")) {
+            shape.clear();
+            for (const auto& extent : args.get_options("--shape"))
+                shape.push_back(std::stoul(extent));
+        }
+        vector<vector<int>> patterns;
+        auto axes = args.get_options("--permute");
+        if (!axes.empty()) {
+            vector<int> perm;
+            for (const auto& axis : axes)
+                perm.push_back(std::stoi(axis));
+            patterns.push_back(perm);
+        } else if (shape.size() == 4) {
+            patterns = { {0, 1, 2, 3}, {0, 2, 3, 1}, {0, 3, 1, 2}, {0, 2, 1, 3}, {1, 0, 2, 3}, {3, 2, 1, 0} };
+        } else {
+            vector<int> reversed(shape.size());
+            for (size_t k = 0; k < shape.size(); k++)
+                reversed[k] = static_cast<int>(shape.size() - 1 - k);
+            patterns.push_back(reversed);
+        }
+        if (!fitsMemoryLimit(3 * elementCount(shape) * sizeof(int), "--permute"))
+            return 1;
+        runPermuteBenchmark(shape, patterns, optimalBlockSize);
+        return 0;
+    }
+
+    unsigned threadCount = defaultThreadCount();
+    if (args.is_present("--threads")) {
+        auto num = std::stoi(args.get_options("--threads")[0]);
+        if (num > 0)
+            threadCount = num;
+    }
+
+    Placement placement = Placement::Compact;
+    if (args.is_present("--placement")) {
+        auto options = args.get_options("--placement");
+        if (options.empty() || !parsePlacement(options[0], placement))
+            cerr << "Unknown placement (expected compact, scatter, physical or l2); using compact" << endl;
+    }
+    if (threadCount > 1)
+        WorkerPool::shared().configure(threadCount, placement);
+
+    TransposeSelector::shared().setThreads(threadCount);
+    if (args.is_present("--calibration")) {
+        auto options = args.get_options("--calibration");
+        if (options.empty())
+            cerr << "--calibration needs a path; using transpose_calibration.txt" << endl;
+        else
+            TransposeSelector::shared().setCalibrationPath(options[0]);
+    }
+    if (args.is_present("--recalibrate"))
+        TransposeSelector::shared().calibrate(true);
+
+    if (args.is_present("--explain")) {
+        if (!fitsMemoryLimit(2 * squareMatrixBytes(n), "--explain"))
+            return 1;
+        vector<vector<int>> A = makeIndexMatrix(n);
+        vector<vector<int>> B(n, vector<int>(n, 0));
+        TransposeSelector::shared().calibrate();
+        auto timer = zen::timer();
+        timer.start();
+        TransposeChoice choice = transpose(A, B);
+        timer.stop();
+        explainChoice(n, choice);
+        cout << "Ran " << algorithmName(choice.algorithm) << " in " << fixed << setprecision(2)
+             << timer.duration<zen::timer::nsec>().count() / 1000.0 << " us, result "
+             << (isTransposeOf(A, B, n) ? "correct" : "WRONG") << endl;
+        return 0;
+    }
+
+    if (args.is_present("--service")) {
+        unsigned clients = 8;
+        auto options = args.get_options("--service");
+        if (!options.empty() && std::stoi(options[0]) > 0)
+            clients = static_cast<unsigned>(std::stoi(options[0]));
+        size_t jobs = 200;
+        if (args.is_present("--iterations") && std::stoi(args.get_options("--iterations")[0]) > 0)
+            jobs = std::stoul(args.get_options("--iterations")[0]);
+        return runServiceBenchmark(clients, jobs) ? 0 : 1;
+    }
+
+    if (args.is_present("--plan")) {
+        PlanRigor rigor = PlanRigor::Estimate;
+        auto options = args.get_options("--plan");
+        if (!options.empty() && options[0] == "measure")
+            rigor = PlanRigor::Measure;
+        else if (!options.empty() && options[0] != "estimate")
+            cerr << "Unknown plan rigor '" << options[0] << "' (expected estimate or measure); using estimate" << endl;
+        size_t calls = 100;
+        if (args.is_present("--iterations") && std::stoi(args.get_options("--iterations")[0]) > 0)
+            calls = std::stoul(args.get_options("--iterations")[0]);
+        // A, B and one output per concurrent caller.
+        if (!fitsMemoryLimit((2 + max(threadCount, 1u)) * squareMatrixBytes(n), "--plan"))
+            return 1;
+        runPlanBenchmark(n, rigor, threadCount, calls);
+        return 0;
+    }
+
+    if (args.is_present("--parallel")) {
+        if (!fitsMemoryLimit(3 * squareMatrixBytes(n), "--parallel"))
+            return 1;
+        runParallelBenchmark(n, optimalBlockSize, threadCount);
+        return 0;
+    }
+
+    if (args.is_present("--layout")) {
+        size_t batch = 0;
+        if (args.is_present("--batch"))
+            batch = std::stoul(args.get_options("--batch")[0]);
+        return runLayoutBenchmark(batch, threadCount, optimalBlockSize) ? 0 : 1;
+    }
+
+    if (args.is_present("--skinny")) {
+        size_t longSide = 1 << 22;
+        auto options = args.get_options("--skinny");
+        if (!options.empty())
+            longSide = std::stoul(options[0]);
+        // src, expected, blocked and dst for the widest (16-column) shape.
+        if (!fitsMemoryLimit(4 * longSide * 16 * sizeof(int), "--skinny"))
+            return 1;
+        runNarrowBenchmark(longSide, threadCount, optimalBlockSize);
+        return 0;
+    }
+
+    if (args.is_present("--aos")) {
+        size_t records = 1 << 22;
+        auto options = args.get_options("--aos");
+        if (!options.empty())
+            records = std::stoul(options[0]);
+        return runAosSoaBenchmark(records, threadCount) ? 0 : 1;
+    }
+
+    // A, B and B_naive; fall back to the in-place kernels when they would not fit the cgroup limit.
+    const ContainerLimits& limits = containerLimits();
+    size_t requiredBytes = 3 * squareMatrixBytes(n);
+    bool overLimit = exceedsMemoryLimit(requiredBytes);
+    if (args.is_present("--in-place") || overLimit) {
+        if (overLimit)
+            cout << "Out-of-place run needs " << (requiredBytes >> 20) << " MB but the " << limits.version
+                 << " cgroup leaves " << (limits.memoryAvailable() >> 20) << " MB; using in-place transpose" << endl;
+        runInPlaceBenchmark(n, optimalBlockSize);
+        return 0;
+    }
+
+    vector<vector<int>> A = makeIndexMatrix(n);
+    vector<vector<int>> B(n, vector<int>(n, 0));
+    vector<vector<int>> B_naive = B;
+
+    if (args.is_present("--repeat")) {
+        size_t repetitions = 20;
+        auto options = args.get_options("--repeat");
+        if (!options.empty() && std::stoi(options[0]) > 0)
+            repetitions = std::stoul(options[0]);
+
+        cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+        cout << " " << setw(18) << left << "Kernel"
+             << setw(17) << "Min (ns)"
+             << setw(17) << "Median (ns)"
+             << setw(17) << "Mean (ns)"
+             << setw(17) << "Stddev (ns)"
+             << setw(17) << "p90 (ns)"
+             << setw(17) << "p99 (ns)"
+             << setw(17) << "Max (ns)" << endl;
+        cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+        InterferenceTally tally;
+        for (bool useBlock : { false, true }) {
+            auto stats = measureClean(repetitions, [&] {
+                if (useBlock)
+                    blockTransposeMatrix(A, B, n, optimalBlockSize);
+                else
+                    naiveTransposeMatrix(A, B_naive, n);
+            }, tally);
+            cout << " " << setw(18) << left << (useBlock ? "block" : "naive") << fixed << setprecision(2)
+                 << setw(17) << stats.min() / 1000.0
+                 << setw(17) << stats.median() / 1000.0
+                 << setw(17) << stats.mean() / 1000.0
+                 << setw(17) << stats.stddev() / 1000.0
+                 << setw(17) << stats.percentile(90) / 1000.0
+                 << setw(17) << stats.percentile(99) / 1000.0
+                 << setw(17) << stats.max() / 1000.0 << endl;
+        }
+        cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+        tally.report(cout);
+        return 0;
+    }
+
+    if (args.is_present("--cache-state")) {
+        vector<CacheState> states = { CacheState::Cold, CacheState::Warm, CacheState::LlcResident };
+        auto names = args.get_options("--cache-state");
+        if (!names.empty()) {
+            states.clear();
+            for (const auto& name : names) {
+                CacheState state;
+                if (parseCacheState(name, state))
+                    states.push_back(state);
+                else
+                    cerr << "Unknown cache state '" << name << "' (expected cold, warm or llc-resident)" << endl;
+            }
+        }
+        int iterations = 5;
+        if (args.is_present("--iterations")) {
+            auto num = std::stoi(args.get_options("--iterations")[0]);
+            if (num > 0)
+                iterations = num;
+        }
+
+        cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+        cout << " " << setw(18) << left << "Cache State"
+             << setw(20) << "Matrix Size (n)"
+             << setw(20) << "Iterations"
+             << setw(20) << "Naive Time (ns)"
+             << setw(20) << "Block Time (ns)"
+             << setw(20) << "Ratio (Naive/Block)" << endl;
+        cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+        InterferenceTally tally;
+        for (auto state : states) {
+            double naiveTime = measureTimeInState(A, B_naive, n, 0, false, state, iterations, tally);
+            double blockTime = measureTimeInState(A, B, n, optimalBlockSize, true, state, iterations, tally);
+            cout << " " << setw(18) << left << cacheStateName(state)
+                 << setw(20) << n
+                 << setw(20) << iterations
+                 << setw(20) << fixed << setprecision(2) << (naiveTime / 1000.0)
+                 << setw(20) << fixed << setprecision(2) << (blockTime / 1000.0)
+                 << setw(20) << fixed << setprecision(2) << (naiveTime / blockTime) << endl;
+        }
+        cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+        tally.report(cout);
+        return 0;
+    }
+
+    RunCycles naiveCycles, blockCycles;
+    InterferenceTally tally;
+    double naiveTime = measureTime(A, B_naive, n, 0, false, &naiveCycles, &tally);
+    double blockTime = measureTime(A, B, n, optimalBlockSize, true, &blockCycles, &tally);
+
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    cout << " " << setw(18) << left << "Matrix Size (n)" 
+         << setw(20) << "L1 Cache (KB)" 
+         << setw(20) << "Associativity" 
+         << setw(20) << "Cache Line (B)" 
+         << setw(20) << "Naive Time (ns)" 
+         << setw(20) << "Block Time (ns)" 
+         << setw(20) << "Ratio (Naive/Block)" << endl;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    cout << " " << setw(18) << left << n 
+         << setw(20) << l1CacheSizeKB 
+         << setw(20) << associativity 
+         << setw(20) << cacheLineSize 
+         << setw(20) << fixed << setprecision(2) << (naiveTime / 1000.0)
+         << setw(20) << fixed << setprecision(2) << (blockTime / 1000.0)
+         << setw(20) << fixed << setprecision(2) << (naiveTime / blockTime) << endl;
+    cout << "-------------------------------------------------------------------------------------------------------------------------------------------" << endl;
+    tally.report(cout);
+
+    if (args.is_present("--probes")) {
+#if TRANSPOSE_PROBES
+        ProbeRegistry::instance().report(cout);
+#else
+        cout << "Stage probes are compiled out (configure with -DTRANSPOSE_PROBES=ON)" << endl;
+#endif
+    }
+
+    if (zen::tsc::invariant())
+        cout << "Timer: invariant TSC at " << fixed << setprecision(3) << zen::tsc::ghz() << " GHz" << endl;
+    else
+        cout << "Timer: steady clock (no invariant TSC reported by CPUID)" << endl;
+    double elements = static_cast<double>(n) * n;
+    for (auto [name, run] : { make_pair("Naive", &naiveCycles), make_pair("Block", &blockCycles) }) {
+        cout << name << ": ";
+        if (run->tsc > 0)
+            cout << run->tsc << " TSC cycles, ";
+        if (run->core > 0)
+            cout << fixed << setprecision(0) << run->core << " core cycles at " << setprecision(2) << run->ghz << " GHz ("
+                 << run->core / elements << " cycles/element, " << run->source << ")" << endl;
+        else
+            cout << "core cycles unknown (" << run->source << ")" << endl;
+    }
+    if (blockCycles.core > 0)
+        cout << "Ratio in core cycles (Naive/Block): " << fixed << setprecision(2) << naiveCycles.core / blockCycles.core << endl;
 
     return 0;
 }
\ No newline at end of file